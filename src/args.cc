@@ -13,6 +13,7 @@
 #include <string.h>
 
 #include <iostream>
+#include <sstream>
 
 namespace fasttext {
 
@@ -21,10 +22,13 @@ Args::Args() {
   dim = 100;
   ws = 5;
   attnws = 10;
+  attnrank = 0;
   epoch = 5;
   minCount = 5;
   minCountLabel = 0;
+  reorder = 0;
   neg = 5;
+  shareNeg = 0;
   wordNgrams = 1;
   loss = loss_name::ns;
   model = model_name::sg;
@@ -33,11 +37,42 @@ Args::Args() {
   minn = 3;
   maxn = 6;
   thread = 12;
+  workers = 0;
+  nodes = 1;
+  rank = 0;
+  master = "127.0.0.1:7700";
+  syncInterval = 5.0;
+  syncRows = 0;
+  batch = 0;
+  deferInput = 0;
   lrUpdateRate = 100;
   t = 1e-4;
   label = "__label__";
   verbose = 2;
+  metrics = "";
+  metricsInterval = 1.0;
+  trace = "";
+  perf = 0;
+  neighbors = "";
+  recallInterval = 5.0;
+  targetRecall = 0.0;
+  dryrun = 0;
+  patience = 0;
+  dryrunTime = 0.0;
+  patientSeed = 0;
+  checkpoint = 0;
+  resume = "";
   pretrainedVectors = "";
+  init = "";
+  streamPrefix = 100000;
+  freeze = "";
+  freezeInput = false;
+  freezeOutput = false;
+  freezeAttn = false;
+  freezeBias = false;
+  freezeInit = false;
+  freezeList = "";
+  grid = "";
   beta_base = 10;
   delta = 0.2;
   nrand = 16;
@@ -88,18 +123,114 @@ void Args::parseArgs(int argc, char** argv) {
       ws = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-attnws") == 0) {
       attnws = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-attnrank") == 0) {
+      attnrank = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-epoch") == 0) {
       epoch = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-minCount") == 0) {
       minCount = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-shareNeg") == 0) {
+      shareNeg = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-loss") == 0) {
+      if (strcmp(argv[ai + 1], "hs") == 0) {
+        loss = loss_name::hs;
+      } else if (strcmp(argv[ai + 1], "ns") == 0) {
+        loss = loss_name::ns;
+      } else if (strcmp(argv[ai + 1], "softmax") == 0) {
+        loss = loss_name::softmax;
+      } else if (strcmp(argv[ai + 1], "sampled") == 0) {
+        loss = loss_name::sampled;
+      } else {
+        std::cout << "Unknown loss: " << argv[ai + 1] << std::endl;
+        printHelp();
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(argv[ai], "-reorder") == 0) {
+      reorder = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-neg") == 0) {
       neg = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-thread") == 0) {
       thread = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-batch") == 0) {
+      batch = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-deferInput") == 0) {
+      deferInput = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-t") == 0) {
       t = atof(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-verbose") == 0) {
       verbose = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-metrics") == 0) {
+      metrics = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-metricsInterval") == 0) {
+      metricsInterval = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-trace") == 0) {
+      trace = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-perf") == 0) {
+      perf = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-neighbors") == 0) {
+      neighbors = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-recallInterval") == 0) {
+      recallInterval = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-targetRecall") == 0) {
+      targetRecall = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-patience") == 0) {
+      patience = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-dryrun") == 0) {
+      dryrun = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-dryrunTime") == 0) {
+      dryrunTime = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-patientSeed") == 0) {
+      patientSeed = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-init") == 0) {
+      init = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-streamPrefix") == 0) {
+      streamPrefix = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-freeze") == 0) {
+      freeze = std::string(argv[ai + 1]);
+      std::string part;
+      for (size_t i = 0; i <= freeze.size(); i++) {
+        if (i < freeze.size() && freeze[i] != ',') {
+          part.push_back(freeze[i]);
+          continue;
+        }
+        if (part == "input") {
+          freezeInput = true;
+        } else if (part == "output") {
+          freezeOutput = true;
+        } else if (part == "attn") {
+          freezeAttn = true;
+        } else if (part == "bias") {
+          freezeBias = true;
+        } else if (part == "init") {
+          // the rows of the -init model, and the position biases
+          freezeInit = true;
+          freezeBias = true;
+        } else {
+          std::cout << "Unknown -freeze parameters: " << part << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        part.clear();
+      }
+    } else if (strcmp(argv[ai], "-freezeList") == 0) {
+      freezeList = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-workers") == 0) {
+      workers = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-nodes") == 0) {
+      nodes = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-rank") == 0) {
+      rank = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-master") == 0) {
+      master = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-syncInterval") == 0) {
+      syncInterval = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-syncRows") == 0) {
+      syncRows = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-grid") == 0) {
+      grid = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-checkpoint") == 0) {
+      checkpoint = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-resume") == 0) {
+      resume = std::string(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-timeUnit") == 0) {
       std::string tmunit(argv[ai + 1]);
       if (tmunit == "day") {
@@ -125,21 +256,124 @@ void Args::parseArgs(int argc, char** argv) {
     printHelp();
     exit(EXIT_FAILURE);
   }
+  if (batch > 0 &&
+      ((model != model_name::attn1 && model != model_name::attn2) ||
+       (loss != loss_name::ns && loss != loss_name::sampled))) {
+    std::cout << "-batch requires attn1 or attn2 with -loss ns or sampled."
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (shareNeg > 0 &&
+      ((model != model_name::attn1 && model != model_name::attn2) ||
+       loss != loss_name::ns || batch > 0)) {
+    std::cout << "-shareNeg requires attn1 or attn2 with -loss ns and "
+                 "-batch 0." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (!init.empty() && reorder) {
+    std::cout << "-init cannot be used with -reorder." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (freezeInit && init.empty()) {
+    std::cout << "-freeze init requires -init." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+#ifndef MCE_PROFILE
+  if (!trace.empty()) {
+    std::cout << "-trace requires a build with profiling (make profile)."
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+#endif
+  if (workers > 0 && (!trace.empty() || perf || !neighbors.empty())) {
+    std::cout << "-trace, -perf and -neighbors cannot be used with -workers."
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if ((!test.empty() || patience > 0) && model != model_name::attn1 &&
+      model != model_name::attn2) {
+    std::cout << "-test and -patience require attn1 or attn2." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (patience > 0 && test.empty()) {
+    std::cout << "-patience requires -test." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (!test.empty() && (workers > 0 || nodes > 1 || input == "-")) {
+    std::cout << "-test cannot be used with -workers, -nodes or -input -."
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (dryrunTime > 0 && !dryrun) {
+    std::cout << "-dryrunTime requires -dryrun 1." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (dryrun && (workers > 0 || nodes > 1 || !resume.empty() ||
+                 !grid.empty() || input == "-")) {
+    std::cout << "-dryrun cannot be used with -workers, -nodes, -resume, "
+                 "-grid or -input -." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (targetRecall > 0 && neighbors.empty()) {
+    std::cout << "-targetRecall requires -neighbors." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (workers > 0 &&
+      (checkpoint > 0 || !resume.empty() || input == "-" || !grid.empty())) {
+    std::cout << "-workers cannot be used with -checkpoint, -resume, -grid "
+                 "or -input -." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (nodes > 1) {
+    if (rank < 0 || rank >= nodes) {
+      std::cout << "-rank must be between 0 and -nodes - 1." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (checkpoint > 0 || !resume.empty() || input == "-" || workers > 0 ||
+        !grid.empty()) {
+      std::cout << "-nodes cannot be used with -checkpoint, -resume, "
+                   "-workers, -grid or -input -." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!grid.empty()) {
+    if (checkpoint > 0 || !resume.empty() || !init.empty() || input == "-") {
+      std::cout << "-grid cannot be used with -checkpoint, -resume, -init or "
+                   "-input -." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    for (const auto& config : expandGrid()) {
+      if (config.shareNeg > 0 && config.batch > 0) {
+        std::cout << "-shareNeg requires -batch 0." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
   if (wordNgrams <= 1 && maxn == 0) {
     bucket = 0;
   }
 }
 
-void Args::printHelp() {
+std::string Args::lossName() const {
   std::string lname = "ns";
   if (loss == loss_name::hs) lname = "hs";
   if (loss == loss_name::softmax) lname = "softmax";
+  if (loss == loss_name::sampled) lname = "sampled";
+  return lname;
+}
+
+void Args::printHelp() {
+  std::string lname = lossName();
   std::cout
       << "\n"
       << "The following arguments are mandatory:\n"
-      << "  -input              training file path\n"
+      << "  -input              training file path, - for stdin\n"
       << "  -output             output file path\n\n"
       << "The following arguments are optional:\n"
+      << "  -test               held-out file, evaluated after each epoch ["
+      << test << "]\n"
+      << "  -patience           stop when the held-out loss did not improve "
+         "for n epochs, 0 for never [" << patience << "]\n"
       << "  -lr                 learning rate [" << lr << "]\n"
       << "  -lrUpdateRate       change the rate of updates for the learning "
          "rate ["
@@ -147,18 +381,157 @@ void Args::printHelp() {
       << "  -dim                size of word vectors [" << dim << "]\n"
       << "  -ws                 size of the context window [" << ws << "]\n"
       << "  -attnws             size of the attention window [" << attnws << "]\n"
+      << "  -attnrank           rank of the factorized attention, 0 for dense ["
+      << attnrank << "]\n"
       << "  -epoch              number of epochs [" << epoch << "]\n"
       << "  -minCount           minimal number of word occurences [" << minCount
       << "]\n"
+      << "  -reorder            give co-occurring words nearby ids "
+         "(0: off, 1: on) ["
+      << reorder << "]\n"
       << "  -neg                number of negatives sampled [" << neg << "]\n"
+      << "  -shareNeg           share negatives among the targets of a visit, "
+         "-loss ns (0: off, 1: on) ["
+      << shareNeg << "]\n"
+      << "  -loss               loss function {ns, hs, softmax, sampled} ["
+      << lname << "]\n"
       << "  -thread             number of threads [" << thread << "]\n"
+      << "  -workers            processes with -thread threads each, on "
+         "shared memory [" << workers << "]\n"
+      << "  -nodes              nodes training together, averaging their "
+         "models [" << nodes << "]\n"
+      << "  -rank               rank of this node, from 0 to -nodes - 1 ["
+      << rank << "]\n"
+      << "  -master             host:port of rank 0 [" << master << "]\n"
+      << "  -syncInterval       seconds between model averagings ["
+      << syncInterval << "]\n"
+      << "  -syncRows           send only the rows changed since the last "
+         "averaging [" << syncRows << "]\n"
+      << "  -batch              targets per mini-batch, 0 for per-example "
+         "updates ["
+      << batch << "]\n"
+      << "  -deferInput         apply input-row gradients every n targets, "
+         "once per row, 0 for immediate updates ["
+      << deferInput << "]\n"
       << "  -t                  sampling threshold [" << t << "]\n"
       << "  -timeUnit           unit of time scope (1: hour, 2: day, 3: week, 4: month) [" << int(timeUnit) << "]\n"
       << "  -verbose            verbosity level [" << verbose << "]\n"
+      << "  -metrics            file of training metrics, one JSON record per "
+         "line [" << metrics << "]\n"
+      << "  -metricsInterval    seconds between metrics records ["
+      << metricsInterval << "]\n"
+      << "  -trace              Chrome trace of the training phases "
+         "(make profile) [" << trace << "]\n"
+      << "  -perf               count cycles, cache and TLB misses of the "
+         "training (0: off, 1: on) [" << perf << "]\n"
+      << "  -neighbors          expected neighbor sets of the concepts, one "
+         "per line, to score the recall of [" << neighbors << "]\n"
+      << "  -recallInterval     seconds between scores of the recall ["
+      << recallInterval << "]\n"
+      << "  -targetRecall       stop the training at this recall, 0 for none ["
+      << targetRecall << "]\n"
+      << "  -dryrun             build the dictionary and print the memory "
+         "needed, without training (0: off, 1: on) [" << dryrun << "]\n"
+      << "  -dryrunTime         seconds of training sampled by -dryrun to "
+         "estimate the training time [" << dryrunTime << "]\n"
+      << "  -patientSeed        seed the random draws of each patient by its id "
+         "and epoch (0: off, 1: on) ["
+      << patientSeed << "]\n"
+      << "  -checkpoint         seconds between checkpoints to <output>.ckpt, "
+         "0 for none ["
+      << checkpoint << "]\n"
+      << "  -resume             checkpoint to resume the training from ["
+      << resume << "]\n"
+      << "  -init               model to continue training on new data from ["
+      << init << "]\n"
+      << "  -streamPrefix       lines of stdin the vocabulary is built from "
+         "(-input -) ["
+      << streamPrefix << "]\n"
+      << "  -freeze             parameters kept fixed, comma separated among "
+         "input,output,attn,bias,init ["
+      << freeze << "]\n"
+      << "  -freezeList         file of the concepts whose rows are kept fixed ["
+      << freezeList << "]\n"
+      << "  -grid               values tried by sweep, e.g. \"dim=64,100 "
+         "neg=5,10\" ["
+      << grid << "]\n"
       << std::endl;
 }
 
+/*
+  setParam: set one of the parameters a sweep can vary (-grid). Returns
+  false for the other names.
+*/
+bool Args::setParam(const std::string& name, const std::string& value) {
+  if (name == "lr") {
+    lr = atof(value.c_str());
+  } else if (name == "dim") {
+    dim = atoi(value.c_str());
+  } else if (name == "attnws") {
+    attnws = atoi(value.c_str());
+  } else if (name == "attnrank") {
+    attnrank = atoi(value.c_str());
+  } else if (name == "neg") {
+    neg = atoi(value.c_str());
+  } else if (name == "epoch") {
+    epoch = atoi(value.c_str());
+  } else if (name == "batch") {
+    batch = atoi(value.c_str());
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/*
+  expandGrid: the configurations of a sweep, one per combination of the
+  values of -grid ("dim=64,100 neg=5,10"). Each one writes its outputs to
+  <output>.<name><value>..., e.g. result/file.dim64.neg5 (and its metrics to
+  <metrics>.dim64.neg5).
+*/
+std::vector<Args> Args::expandGrid() const {
+  std::vector<Args> configs(1, *this);
+  std::istringstream in(grid);
+  std::string param;
+  while (in >> param) {
+    size_t eq = param.find('=');
+    std::string name = param.substr(0, eq);
+    std::vector<std::string> values;
+    std::istringstream list(eq == std::string::npos ? "" : param.substr(eq + 1));
+    std::string value;
+    while (std::getline(list, value, ',')) {
+      if (!value.empty()) values.push_back(value);
+    }
+    if (values.empty() || !Args().setParam(name, values[0])) {
+      std::cout << "Invalid -grid parameter: " << param << std::endl;
+      std::cout << "Use name=v1,v2,... with name among lr, dim, attnws, "
+                   "attnrank, neg, epoch, batch." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::vector<Args> expanded;
+    for (auto& config : configs) {
+      for (auto& v : values) {
+        Args a = config;
+        a.setParam(name, v);
+        a.output += "." + name + v;
+        if (!a.metrics.empty()) {
+          a.metrics += "." + name + v;
+        }
+        if (!a.trace.empty()) {
+          a.trace += "." + name + v;
+        }
+        expanded.push_back(a);
+      }
+    }
+    configs.swap(expanded);
+  }
+  return configs;
+}
+
 void Args::save(std::ostream& out) {
+  int32_t magic = FILE_MAGIC, version = FILE_VERSION;
+  out.write((char*)&(magic), sizeof(int32_t));
+  out.write((char*)&(version), sizeof(int32_t));
   out.write((char*)&(dim), sizeof(int));
   out.write((char*)&(ws), sizeof(int));
   out.write((char*)&(attnws), sizeof(int));
@@ -177,10 +550,22 @@ void Args::save(std::ostream& out) {
   out.write((char*)&(delta), sizeof(double));
   out.write((char*)&(timeUnit), sizeof(time_unit));
   out.write((char*)&(nrand), sizeof(int));
+  out.write((char*)&(attnrank), sizeof(int));
 }
 
 void Args::load(std::istream& in) {
+  int32_t version = 0;
   in.read((char*)&(dim), sizeof(int));
+  if (dim == FILE_MAGIC) {
+    in.read((char*)&(version), sizeof(int32_t));
+    if (version > FILE_VERSION) {
+      std::cerr << "Model file has version " << version
+                << ", this mce reads up to version " << FILE_VERSION << "."
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    in.read((char*)&(dim), sizeof(int));
+  }
   in.read((char*)&(ws), sizeof(int));
   in.read((char*)&(attnws), sizeof(int));
   in.read((char*)&(epoch), sizeof(int));
@@ -198,5 +583,9 @@ void Args::load(std::istream& in) {
   in.read((char*)&(delta), sizeof(double));
   in.read((char*)&(timeUnit), sizeof(time_unit));
   in.read((char*)&(nrand), sizeof(int));
+  attnrank = 0;
+  if (version >= 1) {
+    in.read((char*)&(attnrank), sizeof(int));
+  }
 }
 }
@@ -10,19 +10,29 @@
 #ifndef FASTTEXT_ARGS_H
 #define FASTTEXT_ARGS_H
 
+#include <cstdint>
 #include <istream>
 #include <ostream>
 #include <string>
+#include <vector>
 #include "real.h"
 
 namespace fasttext {
 
 enum class model_name : int { cbow = 1, sg, sup, attn1, attn2 };
-enum class loss_name : int { hs = 1, ns, softmax };
+enum class loss_name : int { hs = 1, ns, softmax, sampled };
 enum class time_unit : int { hour = 1, day, week, month, season, year };
 
 class Args {
  public:
+  /*
+    The .bin and .ckpt files begin with FILE_MAGIC and FILE_VERSION. Files
+    of the first format have neither and begin with -dim; they have no
+    attnrank, which is 0 for them.
+  */
+  static const int32_t FILE_MAGIC = 0x4d434531;
+  static const int32_t FILE_VERSION = 1;
+
   Args();
   std::string input;
   std::string test;
@@ -32,10 +42,13 @@ class Args {
   int dim;
   int ws;
   int attnws;
+  int attnrank;
   int epoch;
   int minCount;
   int minCountLabel;
+  int reorder;
   int neg;
+  int shareNeg;
   int wordNgrams;
   loss_name loss;
   model_name model;
@@ -44,18 +57,52 @@ class Args {
   int minn;
   int maxn;
   int thread;
+  int workers;
+  int nodes;
+  int rank;
+  std::string master;
+  double syncInterval;
+  int syncRows;
+  int batch;
+  int deferInput;
   double t;
   std::string label;
   int verbose;
+  std::string metrics;
+  double metricsInterval;
+  std::string trace;
+  int perf;
+  std::string neighbors;
+  double recallInterval;
+  double targetRecall;
+  int dryrun;
+  int patience;
+  double dryrunTime;
+  int patientSeed;
+  int checkpoint;
+  std::string resume;
   std::string pretrainedVectors;
+  std::string init;
+  int streamPrefix;
+  std::string freeze;
+  bool freezeInput;
+  bool freezeOutput;
+  bool freezeAttn;
+  bool freezeBias;
+  bool freezeInit;
+  std::string freezeList;
+  std::string grid;
   real beta_base;
   real delta;
   int nrand;
 
   void parseArgs(int, char**);
   void printHelp();
+  std::string lossName() const;
   void save(std::ostream&);
   void load(std::istream&);
+  bool setParam(const std::string&, const std::string&);
+  std::vector<Args> expandGrid() const;
 };
 }
 
@@ -0,0 +1,323 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+/*
+  mce-bench: microbenchmarks of the kernels of the training (make bench).
+  Each benchmark is timed over random rows, words or targets, for several
+  dimensions and vocabulary sizes, and reported as one JSON object per
+  line of the "benchmarks" array:
+    {"name": "dotRow", "dim": 100, "vocab": 10000, "ns_per_op": 21.4, ...}
+  usage: mce-bench [-time seconds] [-filter name] [-output file]
+*/
+
+#include <string.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "dictionary.h"
+#include "matrix.h"
+#include "model.h"
+#include "real.h"
+#include "rng.h"
+#include "tree.h"
+#include "vector.h"
+
+using namespace fasttext;
+
+namespace {
+
+// minimal time of a measurement, in seconds
+double minTime = 0.2;
+std::string filter;
+std::vector<std::string> results;
+// results of the timed code, so that the compiler keeps it
+volatile real sink = 0.0;
+
+const int32_t DIMS[] = {50, 100, 200, 300};
+const int32_t VOCABS[] = {10000, 100000};
+// random indices drawn before the timing
+const int32_t NINDICES = 1 << 16;
+
+bool selected(const std::string& name) {
+  return filter.empty() || name.find(filter) != std::string::npos;
+}
+
+/*
+  measure: time f, which does ops operations per call, for at least
+  minTime seconds after a warm-up call, and record ns per operation.
+*/
+template <typename F>
+void measure(const std::string& name, const std::string& params, int64_t ops,
+             F f) {
+  f();
+  int64_t calls = 0;
+  auto begin = std::chrono::steady_clock::now();
+  double elapsed = 0.0;
+  do {
+    f();
+    calls++;
+    elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            begin)
+                  .count();
+  } while (elapsed < minTime);
+  double ns = elapsed * 1e9 / (double(calls) * ops);
+  std::ostringstream json;
+  json << std::fixed << std::setprecision(3) << "{\"name\": \"" << name
+       << "\"" << params << ", \"ns_per_op\": " << ns
+       << ", \"ops\": " << calls * ops << ", \"seconds\": " << elapsed << "}";
+  results.push_back(json.str());
+  std::cerr << std::left << std::setw(22) << name << std::setw(34) << params
+            << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << ns << " ns/op" << std::endl;
+}
+
+std::string params(int32_t dim, int32_t vocab) {
+  std::ostringstream out;
+  if (dim > 0) out << ", \"dim\": " << dim;
+  if (vocab > 0) out << ", \"vocab\": " << vocab;
+  return out.str();
+}
+
+std::vector<int32_t> randomIndices(int32_t n, uint64_t seed) {
+  Rng rng(seed);
+  std::vector<int32_t> indices(NINDICES);
+  for (auto& i : indices) {
+    i = rng.bounded(n);
+  }
+  return indices;
+}
+
+// counts of a Zipf distribution over vocab words, as in EMR data
+std::vector<int64_t> zipfCounts(int32_t vocab) {
+  std::vector<int64_t> counts(vocab);
+  for (int32_t i = 0; i < vocab; i++) {
+    counts[i] = std::max(int64_t(1), int64_t(1e7 / (i + 1)));
+  }
+  return counts;
+}
+
+void benchMatrix() {
+  for (int32_t vocab : VOCABS) {
+    for (int32_t dim : DIMS) {
+      Matrix m(vocab, dim);
+      m.uniform(1.0 / dim);
+      Vector v(dim);
+      for (int32_t j = 0; j < dim; j++) v[j] = 0.01 * j;
+      std::vector<int32_t> rows = randomIndices(vocab, dim);
+      if (selected("dotRow")) {
+        measure("dotRow", params(dim, vocab), NINDICES, [&]() {
+          real s = 0.0;
+          for (int32_t r : rows) s += m.dotRow(v, r);
+          sink = s;
+        });
+      }
+      if (selected("addRow")) {
+        measure("addRow", params(dim, vocab), NINDICES, [&]() {
+          for (int32_t r : rows) m.addRow(v, r, 1e-6);
+        });
+      }
+    }
+  }
+}
+
+void benchVector() {
+  // output layer of the softmax: a product over all the rows
+  for (int32_t vocab : {1000, 10000}) {
+    for (int32_t dim : DIMS) {
+      if (!selected("Vector::mul")) continue;
+      Matrix m(vocab, dim);
+      m.uniform(1.0 / dim);
+      Vector v(dim), out(vocab);
+      for (int32_t j = 0; j < dim; j++) v[j] = 0.01 * j;
+      measure("Vector::mul", params(dim, vocab), 1, [&]() {
+        out.mul(m, v);
+        sink = out[0];
+      });
+    }
+  }
+}
+
+std::shared_ptr<Model> makeModel(int32_t dim, int32_t vocab, loss_name loss,
+                                 std::shared_ptr<Args> args) {
+  args->dim = dim;
+  args->loss = loss;
+  int32_t npos = 2 * args->attnws + 1;
+  auto wi = std::make_shared<Matrix>(vocab, dim);
+  auto wo = std::make_shared<Matrix>(vocab, dim);
+  auto attn = std::make_shared<Matrix>(vocab, npos);
+  auto attnOffset = std::make_shared<Matrix>(1, 1);
+  auto bias = std::make_shared<Vector>(npos);
+  wi->uniform(1.0 / dim);
+  wo->zero();
+  attn->zero();
+  bias->zero();
+  auto model =
+      std::make_shared<Model>(wi, wo, attn, attnOffset, bias, args, 0);
+  std::vector<int64_t> counts = zipfCounts(vocab);
+  if (loss == loss_name::hs) {
+    model->setTree(std::make_shared<HuffmanTree>(counts));
+  }
+  model->setTargetCounts(counts);
+  return model;
+}
+
+void benchModel() {
+  auto args = std::make_shared<Args>();
+  if (selected("softmaxInPlace")) {
+    auto model = makeModel(100, 1000, loss_name::ns, args);
+    for (int32_t n : {10, 20, 40, 80}) {
+      std::vector<real> x(n * NINDICES / 64);
+      Rng rng(n);
+      for (auto& v : x) v = rng.uniform();
+      std::ostringstream p;
+      p << ", \"n\": " << n;
+      // in place again on its output, which is a valid input
+      measure("softmaxInPlace", p.str(), x.size() / n, [&]() {
+        for (size_t i = 0; i < x.size(); i += n) {
+          model->softmaxInPlace(x.data() + i, n);
+        }
+        sink = x[0];
+      });
+    }
+  }
+  for (int32_t vocab : VOCABS) {
+    if (selected("getNegative")) {
+      auto model = makeModel(100, vocab, loss_name::ns, args);
+      // drawNegatives draws -neg negatives with getNegative
+      std::ostringstream p;
+      p << params(0, vocab) << ", \"neg\": " << args->neg;
+      measure("getNegative", p.str(), 1024 * args->neg, [&]() {
+        for (int32_t i = 0; i < 1024; i++) model->drawNegatives();
+      });
+    }
+    for (int32_t dim : DIMS) {
+      if (!selected("hierarchicalSoftmax")) continue;
+      auto model = makeModel(dim, vocab, loss_name::hs, args);
+      std::vector<int32_t> targets = randomIndices(vocab, dim);
+      measure("hierarchicalSoftmax", params(dim, vocab), NINDICES, [&]() {
+        real loss = 0.0;
+        for (int32_t t : targets) loss += model->hierarchicalSoftmax(t, 1e-6);
+        sink = loss;
+      });
+    }
+  }
+}
+
+// a synthetic EMR file: pid, [[ts, [c1, c2]], ...] with Zipf concepts
+std::string emrText(int32_t vocab, int32_t patients) {
+  Rng rng(vocab);
+  std::ostringstream out;
+  for (int32_t p = 0; p < patients; p++) {
+    out << p << ", [";
+    int32_t visits = 1 + rng.bounded(20);
+    for (int32_t v = 0; v < visits; v++) {
+      out << (v > 0 ? ", " : "") << "[" << 17000 + 7 * v << ", [";
+      int32_t concepts = 1 + rng.bounded(8);
+      for (int32_t c = 0; c < concepts; c++) {
+        int32_t id = int32_t(std::pow(real(vocab), rng.uniform())) - 1;
+        out << (c > 0 ? ", " : "") << "c" << id;
+      }
+      out << "]]";
+    }
+    out << "]\n";
+  }
+  return out.str();
+}
+
+void benchDictionary() {
+  auto args = std::make_shared<Args>();
+  args->verbose = 0;
+  for (int32_t vocab : VOCABS) {
+    Dictionary dict(args);
+    std::vector<std::string> words(vocab);
+    for (int32_t i = 0; i < vocab; i++) {
+      words[i] = "c" + std::to_string(i);
+      dict.add(words[i]);
+    }
+    std::vector<int32_t> lookups = randomIndices(vocab, vocab);
+    if (selected("getId")) {
+      measure("getId", params(0, vocab), NINDICES, [&]() {
+        int32_t s = 0;
+        for (int32_t i : lookups) s += dict.getId(words[i]);
+        sink = s;
+      });
+    }
+    if (selected("readWordTime")) {
+      std::string text = emrText(vocab, 2000);
+      int64_t ntokens = 0;
+      {
+        std::istringstream in(text);
+        std::string word;
+        flag_time flag;
+        int32_t brackets = 0;
+        while (dict.readWordTime(in, word, flag, brackets)) ntokens++;
+      }
+      std::ostringstream p;
+      p << params(0, vocab) << ", \"bytes\": " << text.size();
+      measure("readWordTime", p.str(), ntokens, [&]() {
+        std::istringstream in(text);
+        std::string word;
+        flag_time flag;
+        int32_t brackets = 0;
+        int64_t n = 0;
+        while (dict.readWordTime(in, word, flag, brackets)) n++;
+        sink = n;
+      });
+    }
+  }
+}
+}
+
+int main(int argc, char** argv) {
+  std::string output;
+  for (int ai = 1; ai + 1 < argc; ai += 2) {
+    if (strcmp(argv[ai], "-time") == 0) {
+      minTime = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-filter") == 0) {
+      filter = argv[ai + 1];
+    } else if (strcmp(argv[ai], "-output") == 0) {
+      output = argv[ai + 1];
+    } else {
+      std::cerr << "usage: mce-bench [-time seconds] [-filter name] "
+                   "[-output file]" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  benchMatrix();
+  benchVector();
+  benchModel();
+  benchDictionary();
+
+  std::ofstream ofs;
+  if (!output.empty()) {
+    ofs.open(output);
+    if (!ofs.is_open()) {
+      std::cerr << "Output file cannot be opened for saving!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  std::ostream& out = output.empty() ? std::cout : ofs;
+  out << "{\"real\": \"" << (sizeof(real) == 4 ? "float" : "double")
+      << "\", \"min_time\": " << minTime << ", \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    out << (i > 0 ? ",\n  " : "\n  ") << results[i];
+  }
+  out << "\n]}" << std::endl;
+  return 0;
+}
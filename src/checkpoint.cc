@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "checkpoint.h"
+
+#include <csignal>
+
+namespace fasttext {
+
+DirtyRows::DirtyRows(int64_t n) : flags_(new std::atomic<uint8_t>[n]), n_(n) {
+  clear();
+}
+
+void DirtyRows::clear() {
+  for (int64_t i = 0; i < n_; i++) {
+    flags_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+namespace checkpoint {
+
+  static volatile std::sig_atomic_t stop = 0;
+
+  static void onSignal(int) { stop = 1; }
+
+  void saveRows(std::ostream& out, const Matrix& mat, DirtyRows& dirty) {
+    for (int64_t i = 0; i < dirty.size(); i++) {
+      if (dirty.take(i)) {
+        out.write((char*)&i, sizeof(int64_t));
+        out.write((char*)(mat.data_ + i * mat.n_), mat.n_ * sizeof(real));
+      }
+    }
+    int64_t end = -1;
+    out.write((char*)&end, sizeof(int64_t));
+  }
+
+  void loadRows(std::istream& in, Matrix& mat) {
+    int64_t i;
+    while (in.read((char*)&i, sizeof(int64_t)) && i >= 0) {
+      in.read((char*)(mat.data_ + i * mat.n_), mat.n_ * sizeof(real));
+    }
+  }
+
+  void installSignalHandler() { std::signal(SIGTERM, onSignal); }
+
+  bool stopRequested() { return stop != 0; }
+}
+
+}
@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_CHECKPOINT_H
+#define FASTTEXT_CHECKPOINT_H
+
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+
+#include "matrix.h"
+
+namespace fasttext {
+
+/*
+  DirtyRows: one flag per row of a shared matrix, set by the training
+  threads after they write the row and taken by the checkpoint writer
+  before it copies the row. A row written while it is being copied is
+  flagged again, so it is part of the next checkpoint.
+*/
+class DirtyRows {
+ private:
+  std::unique_ptr<std::atomic<uint8_t>[]> flags_;
+  int64_t n_;
+
+ public:
+  explicit DirtyRows(int64_t);
+
+  void mark(int64_t i) {
+    if (flags_[i].load(std::memory_order_relaxed) == 0) {
+      flags_[i].store(1, std::memory_order_release);
+    }
+  }
+  bool take(int64_t i) {
+    return flags_[i].load(std::memory_order_relaxed) != 0 &&
+           flags_[i].exchange(0, std::memory_order_acquire) != 0;
+  }
+  void clear();
+  int64_t size() const { return n_; }
+};
+
+namespace checkpoint {
+
+  // writes the rows flagged in dirty as (id, row) records, ended by id -1
+  void saveRows(std::ostream&, const Matrix&, DirtyRows&);
+  void loadRows(std::istream&, Matrix&);
+
+  // SIGTERM sets a flag that the training threads poll
+  void installSignalHandler();
+  bool stopRequested();
+}
+
+}
+
+#endif
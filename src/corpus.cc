@@ -0,0 +1,94 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "corpus.h"
+
+#include <iostream>
+
+namespace fasttext {
+
+Corpus::Corpus(std::shared_ptr<const Dictionary> dict, bool patientSeed)
+    : dict_(dict), patientSeed_(patientSeed) {
+  visits_.push_back(0);
+  lines_.push_back(0);
+}
+
+void Corpus::load(std::istream& in) {
+  std::vector<word_time> line;
+  uint32_t patient;
+  while (true) {
+    int32_t ntokens = dict_->readLineContext(in, line, patient);
+    if (ntokens == 0) {
+      if (in.eof()) break;
+      continue;
+    }
+    for (auto& visit : line) {
+      words_.insert(words_.end(), visit.wordsID.begin(), visit.wordsID.end());
+      times_.push_back(visit.time);
+      visits_.push_back(words_.size());
+    }
+    lines_.push_back(times_.size());
+    ntokens_.push_back(ntokens);
+    patients_.push_back(patient);
+  }
+  words_.shrink_to_fit();
+  times_.shrink_to_fit();
+  visits_.shrink_to_fit();
+}
+
+int64_t Corpus::size() const { return ntokens_.size(); }
+
+int64_t Corpus::ntokens() const {
+  int64_t n = 0;
+  for (auto t : ntokens_) n += t;
+  return n;
+}
+
+/*
+  getLine: the visits of line i, subsampled with rng. Like getLineContext,
+  the rng is seeded with the patient id with -patientSeed, and visits left
+  empty are dropped except the last one. Returns the tokens of the line.
+*/
+int32_t Corpus::getLine(int64_t i, std::vector<word_time>& words_time,
+                        Rng& rng) const {
+  if (patientSeed_) {
+    rng.seed(patients_[i]);
+  }
+  words_time.clear();
+  word_time wtime;
+  for (int64_t v = lines_[i]; v < lines_[i + 1]; v++) {
+    wtime.time = times_[v];
+    wtime.wordsID.clear();
+    for (int64_t w = visits_[v]; w < visits_[v + 1]; w++) {
+      if (!dict_->discard(words_[w], rng.uniform())) {
+        wtime.wordsID.push_back(words_[w]);
+      }
+    }
+    if (wtime.wordsID.size() > 0 || v + 1 == lines_[i + 1]) {
+      words_time.push_back(wtime);
+    }
+  }
+  return ntokens_[i];
+}
+
+/*
+  getLine: the visits of line i, without subsampling (held-out evaluation).
+*/
+int32_t Corpus::getLine(int64_t i, std::vector<word_time>& words_time) const {
+  words_time.clear();
+  word_time wtime;
+  for (int64_t v = lines_[i]; v < lines_[i + 1]; v++) {
+    wtime.time = times_[v];
+    wtime.wordsID.assign(words_.begin() + visits_[v],
+                         words_.begin() + visits_[v + 1]);
+    words_time.push_back(wtime);
+  }
+  return ntokens_[i];
+}
+}
@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_CORPUS_H
+#define FASTTEXT_CORPUS_H
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <vector>
+
+#include "dictionary.h"
+#include "rng.h"
+
+namespace fasttext {
+
+/*
+  Corpus: the parsed patients of a training file, kept in memory so that
+  several models can be trained on one parse (sweep). Lines are stored
+  before subsampling, which getLine applies with the rng of the caller as
+  Dictionary::getLineContext does.
+*/
+class Corpus {
+ private:
+  std::shared_ptr<const Dictionary> dict_;
+  bool patientSeed_;
+  std::vector<int32_t> words_;     // word ids of all the visits
+  std::vector<int64_t> times_;     // time of each visit
+  std::vector<int64_t> visits_;    // first word of each visit, and the end
+  std::vector<int64_t> lines_;     // first visit of each line, and the end
+  std::vector<int32_t> ntokens_;   // tokens of each line
+  std::vector<uint32_t> patients_; // hash of the patient id of each line
+
+ public:
+  Corpus(std::shared_ptr<const Dictionary>, bool);
+
+  void load(std::istream&);
+  int64_t size() const;
+  int64_t ntokens() const;
+  int32_t getLine(int64_t, std::vector<word_time>&, Rng&) const;
+  int32_t getLine(int64_t, std::vector<word_time>&) const;
+};
+}
+
+#endif
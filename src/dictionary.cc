@@ -12,6 +12,8 @@
 #include <assert.h>
 
 #include <algorithm>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
 #include <iterator>
 #include <stack>
@@ -29,6 +31,7 @@ Dictionary::Dictionary(std::shared_ptr<Args> args) {
   nwords_ = 0;
   nlabels_ = 0;
   ntokens_ = 0;
+  brackets_ = 0;
   word2int_.resize(MAX_VOCAB_SIZE);
   //brackets_ = std::make_shared<std::stack<char>>();
   for (int32_t i = 0; i < MAX_VOCAB_SIZE; i++) {
@@ -207,6 +210,9 @@ bool Dictionary::readWordTime(std::istream& in, std::string& word, flag_time& fl
       } else if (c == ']') {
         //if (!brackets_->empty()) brackets_->pop();
         if (nBrackets > 0) nBrackets--;
+      } else if (nBrackets == 0) {
+        word.push_back(c);
+        flag = flag_time::patient;
       } else if (nBrackets == 2) {
         word.push_back(c);
         flag = flag_time::time;
@@ -256,6 +262,219 @@ void Dictionary::readFromFile(std::istream& in) {
   }
 }
 
+/*
+  reorder: relabel the words so that concepts which co-occur in the same
+  visits get nearby ids, and thus nearby rows in the input, output and
+  attention matrices. One pass over the data builds the co-occurrence graph
+  of the words of each visit (at most REORDER_VISIT_SIZE words per visit and
+  REORDER_MAX_EDGES distinct pairs); every word keeps its REORDER_DEGREE
+  heaviest edges, and the graph is ordered by reverse Cuthill-McKee. Labels
+  keep their place after the words. Must be called before the matrices are
+  built, since it changes the ids.
+*/
+void Dictionary::reorder(std::istream& in) {
+  std::unordered_map<uint64_t, int32_t> weights;
+  std::vector<int32_t> visit;
+  auto addVisit = [&]() {
+    std::sort(visit.begin(), visit.end());
+    visit.erase(std::unique(visit.begin(), visit.end()), visit.end());
+    if (visit.size() > REORDER_VISIT_SIZE) {
+      visit.resize(REORDER_VISIT_SIZE);
+    }
+    for (size_t i = 0; i < visit.size(); i++) {
+      for (size_t j = i + 1; j < visit.size(); j++) {
+        uint64_t key = (uint64_t(visit[i]) << 32) | uint64_t(visit[j]);
+        if (weights.size() < REORDER_MAX_EDGES || weights.count(key)) {
+          weights[key]++;
+        }
+      }
+    }
+    visit.clear();
+  };
+  std::string token;
+  flag_time flag;
+  int32_t nBrackets = 0;
+  while (readWordTime(in, token, flag, nBrackets)) {
+    if (flag == flag_time::patient) continue;
+    if (flag == flag_time::time || token == EOS) {
+      addVisit();
+      continue;
+    }
+    int32_t wid = getId(token);
+    if (wid >= 0 && getType(wid) == entry_type::word) {
+      visit.push_back(wid);
+    }
+  }
+  addVisit();
+
+  // keep the heaviest edges of every word, then make the graph undirected
+  std::vector<std::vector<std::pair<int32_t, int32_t>>> heavy(nwords_);
+  for (auto& w : weights) {
+    int32_t u = w.first >> 32, v = w.first & 0xffffffff;
+    heavy[u].push_back(std::make_pair(w.second, v));
+    heavy[v].push_back(std::make_pair(w.second, u));
+  }
+  std::unordered_map<uint64_t, int32_t>().swap(weights);
+  std::vector<std::vector<int32_t>> adj(nwords_);
+  for (int32_t u = 0; u < nwords_; u++) {
+    auto& h = heavy[u];
+    if (h.size() > REORDER_DEGREE) {
+      std::partial_sort(h.begin(), h.begin() + REORDER_DEGREE, h.end(),
+                        std::greater<std::pair<int32_t, int32_t>>());
+      h.resize(REORDER_DEGREE);
+    }
+    for (auto& e : h) {
+      adj[u].push_back(e.second);
+      adj[e.second].push_back(u);
+    }
+  }
+  for (int32_t u = 0; u < nwords_; u++) {
+    std::vector<std::pair<int32_t, int32_t>>().swap(heavy[u]);
+    std::sort(adj[u].begin(), adj[u].end());
+    adj[u].erase(std::unique(adj[u].begin(), adj[u].end()), adj[u].end());
+  }
+
+  // Cuthill-McKee: breadth-first from the unplaced word of lowest degree,
+  // neighbours by increasing degree; the order is then reversed
+  auto byDegree = [&adj](int32_t a, int32_t b) {
+    return adj[a].size() < adj[b].size();
+  };
+  std::vector<int32_t> starts(nwords_);
+  for (int32_t i = 0; i < nwords_; i++) {
+    starts[i] = i;
+  }
+  std::stable_sort(starts.begin(), starts.end(), byDegree);
+  std::vector<int32_t> order;
+  std::vector<bool> placed(nwords_, false);
+  order.reserve(nwords_);
+  for (int32_t s : starts) {
+    if (placed[s]) continue;
+    placed[s] = true;
+    order.push_back(s);
+    for (size_t q = order.size() - 1; q < order.size(); q++) {
+      std::vector<int32_t>& nbrs = adj[order[q]];
+      std::stable_sort(nbrs.begin(), nbrs.end(), byDegree);
+      for (int32_t v : nbrs) {
+        if (!placed[v]) {
+          placed[v] = true;
+          order.push_back(v);
+        }
+      }
+    }
+  }
+  std::reverse(order.begin(), order.end());
+
+  std::vector<int32_t> newId(nwords_);
+  std::vector<entry> words(size_);
+  for (int32_t i = 0; i < nwords_; i++) {
+    newId[order[i]] = i;
+    words[i] = words_[order[i]];
+  }
+  for (int32_t i = nwords_; i < size_; i++) {
+    words[i] = words_[i];
+  }
+  words_.swap(words);
+  for (int32_t i = 0; i < MAX_VOCAB_SIZE; i++) {
+    word2int_[i] = -1;
+  }
+  for (int32_t i = 0; i < size_; i++) {
+    word2int_[find(words_[i].word)] = i;
+    words_[i].subwords.clear();
+  }
+  initTableDiscard();
+  initNgrams();
+
+  if (args_->verbose > 0) {
+    double newGap = 0.0;
+    for (int32_t u = 0; u < nwords_; u++) {
+      for (int32_t v : adj[u]) {
+        newGap += std::abs(newId[u] - newId[v]);
+      }
+    }
+    double oldGap = 0.0;
+    int64_t nedges = 0;
+    for (int32_t u = 0; u < nwords_; u++) {
+      for (int32_t v : adj[u]) {
+        oldGap += std::abs(u - v);
+        nedges++;
+      }
+    }
+    std::cout << "Reordered words, mean id gap of co-occurring words: "
+              << (nedges > 0 ? oldGap / nedges : 0.0) << " -> "
+              << (nedges > 0 ? newGap / nedges : 0.0) << std::endl;
+  }
+}
+
+/*
+  extend: add the data of a new file to a loaded dictionary (-init). The
+  counts of the new data are added to the existing entries; the new words
+  with at least -minCount occurrences are appended after the existing ones,
+  most frequent first, so that existing ids do not change. Returns the
+  number of tokens of the new data.
+*/
+int64_t Dictionary::extend(std::istream& in) {
+  int32_t oldSize = size_;
+  int64_t oldTokens = ntokens_;
+  std::string word;
+  while (readWord(in, word)) {
+    add(word);
+    if (ntokens_ % 1000000 == 0 && args_->verbose > 1) {
+      std::cout << "\rRead " << (ntokens_ - oldTokens) / 1000000 << "M words"
+                << std::flush;
+    }
+  }
+  std::vector<entry> added(words_.begin() + oldSize, words_.end());
+  added.erase(remove_if(added.begin(), added.end(),
+                        [&](const entry& e) {
+                          return (e.type == entry_type::word &&
+                                  e.count < args_->minCount) ||
+                                 (e.type == entry_type::label &&
+                                  e.count < args_->minCountLabel);
+                        }),
+              added.end());
+  std::stable_sort(added.begin(), added.end(),
+                   [](const entry& e1, const entry& e2) {
+                     if (e1.type != e2.type) return e1.type < e2.type;
+                     return e1.count > e2.count;
+                   });
+  // words first, then labels
+  std::vector<entry> words(words_.begin(), words_.begin() + nwords_);
+  int32_t nadded = 0;
+  for (auto& e : added) {
+    if (e.type == entry_type::word) {
+      words.push_back(e);
+      nadded++;
+    }
+  }
+  words.insert(words.end(), words_.begin() + nwords_,
+               words_.begin() + oldSize);
+  for (auto& e : added) {
+    if (e.type == entry_type::label) words.push_back(e);
+  }
+  words_.swap(words);
+  size_ = 0;
+  nwords_ = 0;
+  nlabels_ = 0;
+  for (int32_t i = 0; i < MAX_VOCAB_SIZE; i++) {
+    word2int_[i] = -1;
+  }
+  for (auto it = words_.begin(); it != words_.end(); ++it) {
+    word2int_[find(it->word)] = size_++;
+    if (it->type == entry_type::word) nwords_++;
+    if (it->type == entry_type::label) nlabels_++;
+    it->subwords.clear();
+  }
+  initTableDiscard();
+  initNgrams();
+  if (args_->verbose > 0) {
+    std::cout << "\rRead " << (ntokens_ - oldTokens) / 1000000 << "M words"
+              << std::endl;
+    std::cout << "Number of words:  " << nwords_ << " (" << nadded << " new)"
+              << std::endl;
+  }
+  return ntokens_ - oldTokens;
+}
+
 void Dictionary::threshold(int64_t t, int64_t tl) {
   sort(words_.begin(), words_.end(), [](const entry& e1, const entry& e2) {
     if (e1.type != e2.type) return e1.type < e2.type;
@@ -311,8 +530,7 @@ void Dictionary::addNgrams(std::vector<int32_t>& line, int32_t n) const {
 
 int32_t Dictionary::getLine(std::istream& in, std::vector<int32_t>& words,
                             std::vector<int32_t>& labels,
-                            std::minstd_rand& rng) const {
-  std::uniform_real_distribution<> uniform(0, 1);
+                            Rng& rng) const {
   std::string token;
   int32_t ntokens = 0;
   words.clear();
@@ -326,7 +544,7 @@ int32_t Dictionary::getLine(std::istream& in, std::vector<int32_t>& words,
     if (wid < 0) continue;
     entry_type type = getType(wid);
     ntokens++;
-    if (type == entry_type::word && !discard(wid, uniform(rng))) {
+    if (type == entry_type::word && !discard(wid, rng.uniform())) {
       words.push_back(wid);
     }
     if (type == entry_type::label) {
@@ -360,19 +578,40 @@ int64_t Dictionary::timeConvert(std::string begin_time,
 int32_t Dictionary::getLineContext(std::istream& in,
                                    std::vector<word_time>& words_time,
                                    std::vector<int32_t>& labels,
-                                   std::minstd_rand& rng) const {
-  std::uniform_real_distribution<> uniform(0, 1);
+                                   Rng& rng) const {
+  labels.clear();
+  if (in.eof()) {
+    in.clear();
+    in.seekg(std::streampos(0));
+  }
+  return parseLineContext(in, words_time, &rng, nullptr);
+}
+
+/*
+  readLineContext: parse the next line without subsampling, and return the
+  hash of its patient id in patient (see Corpus).
+*/
+int32_t Dictionary::readLineContext(std::istream& in,
+                                    std::vector<word_time>& words_time,
+                                    uint32_t& patient) const {
+  patient = 0;
+  return parseLineContext(in, words_time, nullptr, &patient);
+}
+
+/*
+  parseLineContext: parse a line into its visits. Words are subsampled with
+  rng, unless it is null; the hash of the patient id is stored in patient
+  unless it is null.
+*/
+int32_t Dictionary::parseLineContext(std::istream& in,
+                                     std::vector<word_time>& words_time,
+                                     Rng* rng, uint32_t* patient) const {
   std::string token;
   flag_time flag;
   int32_t ntokens = 0;  // the number of visit, combing visits within a time
                         // unit
   words_time.clear();
   std::vector<word_time>().swap(words_time);
-  labels.clear();
-  if (in.eof()) {
-    in.clear();
-    in.seekg(std::streampos(0));
-  }
   //clearStack(brackets_);
   word_time wtime;
   wtime.time = -1;
@@ -380,6 +619,17 @@ int32_t Dictionary::getLineContext(std::istream& in,
   int64_t token_time;
   int32_t nBrackets = 0;
   while (readWordTime(in, token, flag, nBrackets)) {
+    if (flag == flag_time::patient) {
+      // the draws for this patient only depend on its id (and the stream
+      // set by the caller)
+      if (rng && args_->patientSeed) {
+        rng->seed(hash(token));
+      }
+      if (patient) {
+        *patient = hash(token);
+      }
+      continue;
+    }
     if (flag == flag_time::time) {
       //std::cout << "flag in getLineContext: " << int(flag) << std::endl;
       //std::cout << "wtime.time: " << wtime.time << std::endl;
@@ -409,10 +659,11 @@ int32_t Dictionary::getLineContext(std::istream& in,
       int32_t wid = getId(token);
       if (wid < 0) continue;
       entry_type type = getType(wid);
-      //bool isDiscard = discard(wid, uniform(rng));
+      //bool isDiscard = discard(wid, rng.uniform());
       //std::cout << "isDiscard: " << isDiscard << std::endl;
       ntokens++;
-      if (type == entry_type::word && !discard(wid, uniform(rng))) {
+      if (type == entry_type::word &&
+          !(rng && discard(wid, rng->uniform()))) {
         //std::cout << "wid: " << wid << std::endl;
         wtime.wordsID.push_back(wid);
       }
@@ -475,4 +726,18 @@ void Dictionary::load(std::istream& in) {
   initTableDiscard();
   initNgrams();
 }
+
+int64_t Dictionary::bytes() const {
+  int64_t bytes = sizeof(int32_t) * word2int_.capacity() +
+                  sizeof(entry) * words_.capacity() +
+                  sizeof(real) * pdiscard_.capacity();
+  for (const auto& e : words_) {
+    // beyond the characters stored in the string itself
+    if (e.word.capacity() > 15) {
+      bytes += e.word.capacity() + 1;
+    }
+    bytes += sizeof(int32_t) * e.subwords.capacity();
+  }
+  return bytes;
+}
 }
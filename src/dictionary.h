@@ -20,12 +20,13 @@
 
 #include "args.h"
 #include "real.h"
+#include "rng.h"
 
 namespace fasttext {
 
 typedef int32_t id_type;
 enum class entry_type : int8_t {word=0, label=1};
-enum class flag_time : int8_t {time=0, word=1};
+enum class flag_time : int8_t {time=0, word=1, patient=2};
 
 struct entry {
   std::string word;
@@ -43,10 +44,16 @@ class Dictionary {
   private:
     static const int32_t MAX_VOCAB_SIZE = 30000000;
     static const int32_t MAX_LINE_SIZE = 1024;
+    // bounds of the co-occurrence graph built by reorder
+    static const int32_t REORDER_VISIT_SIZE = 64;
+    static const int32_t REORDER_DEGREE = 16;
+    static const int32_t REORDER_MAX_EDGES = 1 << 22;
 
     int32_t find(const std::string&) const;
     void initTableDiscard();
     void initNgrams();
+    int32_t parseLineContext(std::istream&, std::vector<word_time>&, Rng*,
+                             uint32_t*) const;
 
     //std::shared_ptr<std::stack<char>> brackets_;//count how many square brackets
     mutable int brackets_;
@@ -82,16 +89,22 @@ class Dictionary {
     bool readWordTime(std::istream&, std::string&, flag_time&, int32_t&) const;
     void clearStack(std::shared_ptr<std::stack<char>>) const;
     void readFromFile(std::istream&);
+    void reorder(std::istream&);
+    int64_t extend(std::istream&);
     std::string getLabel(int32_t) const;
     void save(std::ostream&) const;
     void load(std::istream&);
     std::vector<int64_t> getCounts(entry_type) const;
+    // memory held by the dictionary, in bytes (-dryrun)
+    int64_t bytes() const;
     void addNgrams(std::vector<int32_t>&, int32_t) const;
     int32_t getLine(std::istream&, std::vector<int32_t>&,
-                    std::vector<int32_t>&, std::minstd_rand&) const;
+                    std::vector<int32_t>&, Rng&) const;
     int64_t timeConvert(std::string, std::string) const;
     int32_t getLineContext(std::istream&, std::vector<word_time>&,
-                    std::vector<int32_t>&, std::minstd_rand&) const;
+                    std::vector<int32_t>&, Rng&) const;
+    int32_t readLineContext(std::istream&, std::vector<word_time>&,
+                            uint32_t&) const;
     void threshold(int64_t, int64_t);
 };
 
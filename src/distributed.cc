@@ -0,0 +1,393 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "distributed.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+namespace fasttext {
+
+// seconds the other ranks keep trying to reach rank 0
+static const int CONNECT_TIMEOUT = 60;
+
+static void fail(const std::string& what) {
+  std::cerr << "Sync: " << what << ": " << strerror(errno) << std::endl;
+  exit(EXIT_FAILURE);
+}
+
+static void writeAll(int fd, const char* p, size_t n) {
+  while (n > 0) {
+    ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+    if (k < 0 && errno == EINTR) continue;
+    if (k <= 0) fail("send failed");
+    p += k;
+    n -= k;
+  }
+}
+
+static void readAll(int fd, char* p, size_t n) {
+  while (n > 0) {
+    ssize_t k = recv(fd, p, n, 0);
+    if (k < 0 && errno == EINTR) continue;
+    if (k == 0) errno = ECONNRESET;
+    if (k <= 0) fail("receive failed");
+    p += k;
+    n -= k;
+  }
+}
+
+static void malformed() {
+  std::cerr << "Sync: malformed message from another node." << std::endl;
+  exit(EXIT_FAILURE);
+}
+
+static void sendMessage(int fd, const std::vector<char>& buf) {
+  int64_t size = buf.size();
+  writeAll(fd, (const char*)&size, sizeof(int64_t));
+  writeAll(fd, buf.data(), buf.size());
+}
+
+/*
+  recvMessage: receive a message of at most limit bytes into buf.
+*/
+static void recvMessage(int fd, std::vector<char>& buf, int64_t limit) {
+  int64_t size;
+  readAll(fd, (char*)&size, sizeof(int64_t));
+  if (size < 0 || size > limit) {
+    malformed();
+  }
+  buf.resize(size);
+  readAll(fd, buf.data(), size);
+}
+
+static void put(std::vector<char>& buf, const void* p, size_t n) {
+  buf.insert(buf.end(), (const char*)p, (const char*)p + n);
+}
+
+template <typename T>
+static T get(const std::vector<char>& buf, size_t& pos) {
+  if (buf.size() - pos < sizeof(T)) {
+    malformed();
+  }
+  T value;
+  memcpy(&value, buf.data() + pos, sizeof(T));
+  pos += sizeof(T);
+  return value;
+}
+
+ParameterSync::ParameterSync(std::shared_ptr<Args> args,
+                             std::vector<std::shared_ptr<Matrix>> params,
+                             std::vector<std::shared_ptr<DirtyRows>> dirty)
+    : args_(args), params_(params), dirty_(dirty), rounds_(0), bytes_(0) {
+  // the done flag, and every row of every parameter
+  maxMessage_ = sizeof(int32_t);
+  for (auto& p : params_) {
+    maxMessage_ += sizeof(int64_t) +
+                   p->m_ * (sizeof(int64_t) + p->n_ * sizeof(real));
+  }
+  for (auto& p : params_) {
+    base_.push_back(*p);
+    Matrix zero(p->m_, p->n_);
+    zero.zero();
+    delta_.push_back(zero);
+    if (args_->rank == 0) {
+      sum_.push_back(zero);
+      touched_.push_back(std::vector<uint8_t>(p->m_, 0));
+    }
+  }
+  rows_.resize(params_.size());
+  sent_.resize(params_.size());
+}
+
+ParameterSync::~ParameterSync() {
+  for (int fd : sockets_) {
+    close(fd);
+  }
+}
+
+/*
+  connect: set up the connections, and check that all the nodes start from
+  the same model (same dictionary and initial parameters), described by
+  check.
+*/
+void ParameterSync::connect(const std::vector<int64_t>& check) {
+  size_t colon = args_->master.rfind(':');
+  if (colon == std::string::npos) {
+    std::cerr << "-master must be host:port." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::string host = args_->master.substr(0, colon);
+  std::string port = args_->master.substr(colon + 1);
+  int64_t ncheck = check.size();
+  if (args_->rank == 0) {
+    // listen on the address of -master only, all of them if it has no host
+    addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(),
+                    &hints, &res) != 0) {
+      std::cerr << "Sync: cannot resolve " << host << "." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    if (server < 0) fail("socket failed");
+    int one = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(server, res->ai_addr, res->ai_addrlen) != 0) {
+      fail("cannot listen on " + args_->master);
+    }
+    freeaddrinfo(res);
+    listen(server, args_->nodes);
+    sockets_.assign(args_->nodes - 1, -1);
+    for (int32_t i = 1; i < args_->nodes; i++) {
+      int fd = accept(server, nullptr, nullptr);
+      if (fd < 0) fail("accept failed");
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      std::vector<char> hello;
+      recvMessage(fd, hello, sizeof(int32_t) + ncheck * sizeof(int64_t));
+      size_t pos = 0;
+      int32_t rank = get<int32_t>(hello, pos);
+      bool same = hello.size() == sizeof(int32_t) + ncheck * sizeof(int64_t);
+      for (int64_t k = 0; same && k < ncheck; k++) {
+        same = get<int64_t>(hello, pos) == check[k];
+      }
+      if (rank <= 0 || rank >= args_->nodes || sockets_[rank - 1] >= 0) {
+        std::cerr << "Sync: unexpected rank " << rank << "." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      if (!same) {
+        std::cerr << "Sync: rank " << rank
+                  << " does not start from the same dictionary and "
+                     "parameters." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      sockets_[rank - 1] = fd;
+    }
+    close(server);
+  } else {
+    addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+      std::cerr << "Sync: cannot resolve " << host << "." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    int fd = -1;
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::seconds(CONNECT_TIMEOUT);
+    while (true) {
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (fd < 0) fail("socket failed");
+      if (::connect(fd, res->ai_addr, res->ai_addrlen) == 0) break;
+      close(fd);
+      if (std::chrono::steady_clock::now() > deadline) {
+        fail("cannot connect to " + args_->master);
+      }
+      // rank 0 may not be listening yet
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    freeaddrinfo(res);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    std::vector<char> hello;
+    int32_t rank = args_->rank;
+    put(hello, &rank, sizeof(int32_t));
+    put(hello, check.data(), ncheck * sizeof(int64_t));
+    sendMessage(fd, hello);
+    sockets_.push_back(fd);
+  }
+}
+
+/*
+  encodeDeltas: write to out_ the done flag and, for each parameter, the
+  rows that changed since the previous round as (id, change) records ended
+  by id -1. The changes are kept in delta_.
+*/
+void ParameterSync::encodeDeltas(bool done) {
+  out_.clear();
+  int32_t flag = done;
+  put(out_, &flag, sizeof(int32_t));
+  for (size_t p = 0; p < params_.size(); p++) {
+    const Matrix& cur = *params_[p];
+    int64_t n = cur.n_;
+    for (int64_t i = 0; i < cur.m_; i++) {
+      if (dirty_[p] && !dirty_[p]->take(i)) continue;
+      const real* c = cur.data_ + i * n;
+      const real* b = base_[p].data_ + i * n;
+      real* d = delta_[p].data_ + i * n;
+      bool changed = false;
+      for (int64_t j = 0; j < n; j++) {
+        d[j] = c[j] - b[j];
+        changed |= d[j] != 0.0;
+      }
+      if (!changed) continue;
+      sent_[p].push_back(i);
+      put(out_, &i, sizeof(int64_t));
+      put(out_, d, n * sizeof(real));
+    }
+    int64_t end = -1;
+    put(out_, &end, sizeof(int64_t));
+  }
+}
+
+/*
+  nextRecord: read the id i of the next changed row of parameter p at pos;
+  false at the end of the rows of p. The id and the change that follows it
+  are checked against the parameter and the message.
+*/
+bool ParameterSync::nextRecord(const std::vector<char>& buf, size_t& pos,
+                               size_t p, int64_t& i) const {
+  i = get<int64_t>(buf, pos);
+  if (i == -1) {
+    return false;
+  }
+  if (i < 0 || i >= params_[p]->m_ ||
+      buf.size() - pos < params_[p]->n_ * sizeof(real)) {
+    malformed();
+  }
+  return true;
+}
+
+/*
+  addDeltas: add the changes of a node to sum_ (rank 0), and return its
+  done flag.
+*/
+bool ParameterSync::addDeltas(const std::vector<char>& buf) {
+  size_t pos = 0;
+  bool done = get<int32_t>(buf, pos) != 0;
+  for (size_t p = 0; p < params_.size(); p++) {
+    int64_t n = params_[p]->n_;
+    int64_t i;
+    while (nextRecord(buf, pos, p, i)) {
+      real* s = sum_[p].data_ + i * n;
+      const real* d = (const real*)(buf.data() + pos);
+      for (int64_t j = 0; j < n; j++) {
+        s[j] += d[j];
+      }
+      pos += n * sizeof(real);
+      if (!touched_[p][i]) {
+        touched_[p][i] = 1;
+        rows_[p].push_back(i);
+      }
+    }
+  }
+  if (pos != buf.size()) {
+    malformed();
+  }
+  return done;
+}
+
+/*
+  apply: replace the change of row i of parameter p, sent in this round,
+  by the mean change m of all nodes.
+*/
+void ParameterSync::apply(size_t p, int64_t i, const real* m) {
+  int64_t n = params_[p]->n_;
+  real* c = params_[p]->data_ + i * n;
+  real* b = base_[p].data_ + i * n;
+  const real* d = delta_[p].data_ + i * n;
+  for (int64_t j = 0; j < n; j++) {
+    c[j] += m[j] - d[j];
+    b[j] += m[j];
+  }
+}
+
+/*
+  round: one averaging round. done tells that the training of this node is
+  over; returns true once it is over on all the nodes, in which case all
+  the nodes hold the same parameters.
+*/
+bool ParameterSync::round(bool done) {
+  encodeDeltas(done);
+  bool allDone;
+  if (args_->rank != 0) {
+    sendMessage(sockets_[0], out_);
+    bytes_ += out_.size();
+    recvMessage(sockets_[0], in_, maxMessage_);
+    size_t pos = 0;
+    allDone = get<int32_t>(in_, pos) != 0;
+    for (size_t p = 0; p < params_.size(); p++) {
+      int64_t n = params_[p]->n_;
+      int64_t i;
+      while (nextRecord(in_, pos, p, i)) {
+        apply(p, i, (const real*)(in_.data() + pos));
+        pos += n * sizeof(real);
+      }
+    }
+    if (pos != in_.size()) {
+      malformed();
+    }
+  } else {
+    allDone = addDeltas(out_);
+    for (int fd : sockets_) {
+      recvMessage(fd, in_, maxMessage_);
+      allDone = addDeltas(in_) && allDone;
+    }
+    out_.clear();
+    int32_t flag = allDone;
+    put(out_, &flag, sizeof(int32_t));
+    for (size_t p = 0; p < params_.size(); p++) {
+      int64_t n = params_[p]->n_;
+      std::vector<real> mean(n);
+      for (int64_t i : rows_[p]) {
+        real* s = sum_[p].data_ + i * n;
+        for (int64_t j = 0; j < n; j++) {
+          mean[j] = s[j] / args_->nodes;
+          s[j] = 0.0;
+        }
+        apply(p, i, mean.data());
+        touched_[p][i] = 0;
+        put(out_, &i, sizeof(int64_t));
+        put(out_, mean.data(), n * sizeof(real));
+      }
+      rows_[p].clear();
+      int64_t end = -1;
+      put(out_, &end, sizeof(int64_t));
+    }
+    for (int fd : sockets_) {
+      sendMessage(fd, out_);
+      bytes_ += out_.size();
+    }
+  }
+  for (size_t p = 0; p < params_.size(); p++) {
+    int64_t n = params_[p]->n_;
+    for (int64_t i : sent_[p]) {
+      real* d = delta_[p].data_ + i * n;
+      for (int64_t j = 0; j < n; j++) {
+        d[j] = 0.0;
+      }
+    }
+    sent_[p].clear();
+  }
+  if (allDone) {
+    // the training is over: end with the exact average on every node
+    for (size_t p = 0; p < params_.size(); p++) {
+      std::copy(base_[p].data_, base_[p].data_ + base_[p].m_ * base_[p].n_,
+                params_[p]->data_);
+    }
+  }
+  rounds_++;
+  return allDone;
+}
+}
@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_DISTRIBUTED_H
+#define FASTTEXT_DISTRIBUTED_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "args.h"
+#include "checkpoint.h"
+#include "matrix.h"
+
+namespace fasttext {
+
+/*
+  ParameterSync: model averaging between the nodes of a -nodes run, over
+  TCP. Rank 0 accepts a connection from every other rank. In each round,
+  every node sends the change of its parameters since the previous round
+  (all rows, or with -syncRows only the rows flagged in dirty), rank 0
+  averages the changes and sends the mean back, and every node adds it to
+  its parameters in place of its own change. Updates made by the training
+  threads during a round are kept.
+*/
+class ParameterSync {
+ private:
+  std::shared_ptr<Args> args_;
+  std::vector<std::shared_ptr<Matrix>> params_;
+  std::vector<std::shared_ptr<DirtyRows>> dirty_;
+  // parameters after the previous round, and the change sent in this one
+  std::vector<Matrix> base_;
+  std::vector<Matrix> delta_;
+  // rank 0: sum of the changes of all nodes, and the rows in it
+  std::vector<Matrix> sum_;
+  std::vector<std::vector<uint8_t>> touched_;
+  std::vector<std::vector<int64_t>> rows_;
+  // rows sent in this round
+  std::vector<std::vector<int64_t>> sent_;
+  // rank 0: one socket per other rank; other ranks: the socket to rank 0
+  std::vector<int> sockets_;
+  std::vector<char> out_;
+  std::vector<char> in_;
+  int64_t rounds_;
+  int64_t bytes_;
+  // size of a message with every row of every parameter
+  int64_t maxMessage_;
+
+  void encodeDeltas(bool);
+  bool nextRecord(const std::vector<char>&, size_t&, size_t, int64_t&) const;
+  bool addDeltas(const std::vector<char>&);
+  void apply(size_t, int64_t, const real*);
+
+ public:
+  ParameterSync(std::shared_ptr<Args>, std::vector<std::shared_ptr<Matrix>>,
+                std::vector<std::shared_ptr<DirtyRows>>);
+  ~ParameterSync();
+
+  void connect(const std::vector<int64_t>&);
+  bool round(bool);
+  int64_t rounds() const { return rounds_; }
+  int64_t bytes() const { return bytes_; }
+};
+}
+
+#endif
@@ -0,0 +1,111 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "evaluator.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace fasttext {
+
+Evaluator::Evaluator(std::shared_ptr<Args> args,
+                     std::shared_ptr<Dictionary> dict,
+                     std::shared_ptr<const Corpus> corpus,
+                     std::shared_ptr<const HuffmanTree> tree,
+                     const Matrix& input, const Matrix& output,
+                     const Matrix& attn, const Matrix& attnOffset,
+                     const Vector& bias, int32_t threads)
+    : args_(args), corpus_(corpus), targets_(0) {
+  input_ = std::make_shared<Matrix>(input);
+  output_ = std::make_shared<Matrix>(output);
+  attn_ = std::make_shared<Matrix>(attn);
+  attnOffset_ = std::make_shared<Matrix>(attnOffset);
+  bias_ = std::make_shared<Vector>(bias.m_);
+  std::copy(bias.data_, bias.data_ + bias.m_, bias_->data_);
+  std::vector<int64_t> counts = dict->getCounts(entry_type::word);
+  for (int32_t i = 0; i < threads; i++) {
+    // the same seed, so the threads have the same negative table
+    models_.emplace_back(new Model(input_, output_, attn_, attnOffset_, bias_,
+                                   args_, 0));
+    models_.back()->setTree(tree);
+    models_.back()->setTargetCounts(counts);
+  }
+}
+
+/*
+  snapshot: copy the parameters to evaluate, of the same shapes as the
+  first ones. The copy reads the rows while the training threads may write
+  them, like the training threads do.
+*/
+void Evaluator::snapshot(const Matrix& input, const Matrix& output,
+                         const Matrix& attn, const Matrix& attnOffset,
+                         const Vector& bias) {
+  std::copy(input.data_, input.data_ + input.m_ * input.n_, input_->data_);
+  std::copy(output.data_, output.data_ + output.m_ * output.n_,
+            output_->data_);
+  std::copy(attn.data_, attn.data_ + attn.m_ * attn.n_, attn_->data_);
+  std::copy(attnOffset.data_, attnOffset.data_ + attnOffset.m_ * attnOffset.n_,
+            attnOffset_->data_);
+  std::copy(bias.data_, bias.data_ + bias.m_, bias_->data_);
+}
+
+void Evaluator::evalThread(int32_t threadId, double& loss, int64_t& targets) {
+  Model& model = *models_[threadId];
+  std::vector<word_time> line;
+  std::vector<std::pair<int32_t, int32_t>> seq, input;
+  const int32_t nthreads = models_.size();
+  for (int64_t i = threadId; i < corpus_->size(); i += nthreads) {
+    corpus_->getLine(i, line);
+    model.rng.seed(i);
+    model.seekNegatives();
+    seq.clear();
+    for (const auto& wt : line) {
+      for (auto feature : wt.wordsID) {
+        seq.push_back(std::make_pair(feature, wt.time));
+      }
+    }
+    for (int32_t f = 0; f < int32_t(seq.size()); f++) {
+      input.clear();
+      for (int32_t c = -args_->ws; c <= args_->ws; c++) {
+        if (c != 0 && f + c >= 0 && f + c < int32_t(seq.size())) {
+          int32_t distance = seq[f + c].second - seq[f].second + args_->attnws;
+          if (distance < 0 || distance > 2 * args_->attnws) continue;
+          input.push_back(std::make_pair(seq[f + c].first, distance));
+        }
+      }
+      real l;
+      if (model.evalAttn(input, seq[f].first, l)) {
+        loss += l;
+        targets++;
+      }
+    }
+  }
+}
+
+real Evaluator::evaluate() {
+  const int32_t nthreads = models_.size();
+  std::vector<double> losses(nthreads, 0.0);
+  std::vector<int64_t> targets(nthreads, 0);
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < nthreads; i++) {
+    threads.push_back(std::thread(
+        [&, i]() { evalThread(i, losses[i], targets[i]); }));
+  }
+  for (auto it = threads.begin(); it != threads.end(); ++it) {
+    it->join();
+  }
+  double loss = 0.0;
+  targets_ = 0;
+  for (int32_t i = 0; i < nthreads; i++) {
+    loss += losses[i];
+    targets_ += targets[i];
+  }
+  return targets_ > 0 ? loss / targets_ : 0.0;
+}
+}
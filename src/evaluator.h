@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_EVALUATOR_H
+#define FASTTEXT_EVALUATOR_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "args.h"
+#include "corpus.h"
+#include "dictionary.h"
+#include "matrix.h"
+#include "model.h"
+#include "real.h"
+#include "tree.h"
+#include "vector.h"
+
+namespace fasttext {
+
+/*
+  Evaluator: loss of a model on held-out patients (eval, -test). The
+  parameters are copied to a snapshot, which the evaluation threads only
+  read, so that the training threads can go on updating theirs. Each
+  thread scores every threads-th patient, with the whole -ws window and the
+  negatives drawn from a seed of the patient, so the loss does not depend
+  on the number of threads and two evaluations of the same parameters
+  give the same loss.
+*/
+class Evaluator {
+ private:
+  std::shared_ptr<Args> args_;
+  std::shared_ptr<const Corpus> corpus_;
+  std::shared_ptr<Matrix> input_;
+  std::shared_ptr<Matrix> output_;
+  std::shared_ptr<Matrix> attn_;
+  std::shared_ptr<Matrix> attnOffset_;
+  std::shared_ptr<Vector> bias_;
+  // one per thread, built once with their negative tables
+  std::vector<std::unique_ptr<Model>> models_;
+  int64_t targets_;
+
+  void evalThread(int32_t, double&, int64_t&);
+
+ public:
+  // the parameters are those of the first snapshot
+  Evaluator(std::shared_ptr<Args>, std::shared_ptr<Dictionary>,
+            std::shared_ptr<const Corpus>,
+            std::shared_ptr<const HuffmanTree>, const Matrix&, const Matrix&,
+            const Matrix&, const Matrix&, const Vector&, int32_t);
+
+  void snapshot(const Matrix&, const Matrix&, const Matrix&, const Matrix&,
+                const Vector&);
+  // mean loss per target
+  real evaluate();
+  // targets scored by the last evaluation
+  int64_t targets() const { return targets_; }
+};
+}
+
+#endif
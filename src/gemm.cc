@@ -0,0 +1,99 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "gemm.h"
+
+#include <algorithm>
+
+namespace fasttext {
+
+namespace gemm {
+
+  // rows of the output computed together, so that every row of the other
+  // operand loaded from memory is reused from registers/L1
+  static const int64_t ROW_BLOCK = 4;
+  // columns of the inner dimension kept in L1 at a time
+  static const int64_t COL_BLOCK = 256;
+
+  void abt(int64_t m, int64_t n, int64_t k, const real* A, const real* B,
+           real* C) {
+    int64_t i = 0;
+    for (; i + ROW_BLOCK <= m; i += ROW_BLOCK) {
+      const real* a0 = A + (i + 0) * k;
+      const real* a1 = A + (i + 1) * k;
+      const real* a2 = A + (i + 2) * k;
+      const real* a3 = A + (i + 3) * k;
+      for (int64_t j = 0; j < n; j++) {
+        const real* b = B + j * k;
+        real c0 = 0.0, c1 = 0.0, c2 = 0.0, c3 = 0.0;
+        for (int64_t l = 0; l < k; l++) {
+          c0 += a0[l] * b[l];
+          c1 += a1[l] * b[l];
+          c2 += a2[l] * b[l];
+          c3 += a3[l] * b[l];
+        }
+        C[(i + 0) * n + j] = c0;
+        C[(i + 1) * n + j] = c1;
+        C[(i + 2) * n + j] = c2;
+        C[(i + 3) * n + j] = c3;
+      }
+    }
+    for (; i < m; i++) {
+      const real* a = A + i * k;
+      for (int64_t j = 0; j < n; j++) {
+        const real* b = B + j * k;
+        real c = 0.0;
+        for (int64_t l = 0; l < k; l++) {
+          c += a[l] * b[l];
+        }
+        C[i * n + j] = c;
+      }
+    }
+  }
+
+  void ab(int64_t m, int64_t n, int64_t k, const real* A, const real* B,
+          real* C) {
+    std::fill(C, C + m * n, 0.0);
+    for (int64_t j0 = 0; j0 < n; j0 += COL_BLOCK) {
+      int64_t j1 = std::min(n, j0 + COL_BLOCK);
+      for (int64_t i = 0; i < m; i++) {
+        real* c = C + i * n;
+        for (int64_t l = 0; l < k; l++) {
+          real a = A[i * k + l];
+          if (a == 0.0) continue;
+          const real* b = B + l * n;
+          for (int64_t j = j0; j < j1; j++) {
+            c[j] += a * b[j];
+          }
+        }
+      }
+    }
+  }
+
+  void atb(int64_t m, int64_t n, int64_t k, const real* A, const real* B,
+           real* C) {
+    std::fill(C, C + m * n, 0.0);
+    for (int64_t j0 = 0; j0 < n; j0 += COL_BLOCK) {
+      int64_t j1 = std::min(n, j0 + COL_BLOCK);
+      for (int64_t l = 0; l < k; l++) {
+        const real* b = B + l * n;
+        for (int64_t i = 0; i < m; i++) {
+          real a = A[l * m + i];
+          if (a == 0.0) continue;
+          real* c = C + i * n;
+          for (int64_t j = j0; j < j1; j++) {
+            c[j] += a * b[j];
+          }
+        }
+      }
+    }
+  }
+}
+
+}
@@ -0,0 +1,39 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_GEMM_H
+#define FASTTEXT_GEMM_H
+
+#include <cstdint>
+
+#include "real.h"
+
+namespace fasttext {
+
+/*
+  Cache-blocked matrix products on dense row-major blocks, used by the
+  mini-batch engine. All matrices are contiguous; rows of A, B and C have
+  the lengths given by the inner dimension of each product.
+*/
+namespace gemm {
+
+  // C (m x n) = A (m x k) * B (n x k)^T
+  void abt(int64_t m, int64_t n, int64_t k, const real* A, const real* B,
+           real* C);
+  // C (m x n) = A (m x k) * B (k x n)
+  void ab(int64_t m, int64_t n, int64_t k, const real* A, const real* B,
+          real* C);
+  // C (m x n) = A (k x m)^T * B (k x n)
+  void atb(int64_t m, int64_t n, int64_t k, const real* A, const real* B,
+           real* C);
+}
+
+}
+
+#endif
@@ -0,0 +1,351 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "generator.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+namespace fasttext {
+
+namespace {
+  // faster than std::to_string, which allocates a string per concept
+  void appendInt(std::string& line, int64_t value) {
+    char buffer[24];
+    char* end = buffer + sizeof(buffer);
+    char* p = end;
+    do {
+      *--p = char('0' + value % 10);
+      value /= 10;
+    } while (value > 0);
+    line.append(p, end - p);
+  }
+}
+
+Generator::Generator() {
+  patients_ = 100000;
+  vocab_ = 10000;
+  zipf_ = 1.0;
+  visits_ = 10.0;
+  codes_ = 5.0;
+  gap_ = 30.0;
+  gapDist_ = gap_dist::exp;
+  start_ = 1262304000.0;
+  cluster_ = 0;
+  coherence_ = 0.8;
+  thread_ = 12;
+  seed_ = 0;
+  verbose_ = 2;
+}
+
+void Generator::parseArgs(int argc, char** argv) {
+  int ai = 2;
+  while (ai < argc) {
+    if (argv[ai][0] != '-') {
+      std::cout << "Provided argument without a dash! Usage:" << std::endl;
+      printHelp();
+      exit(EXIT_FAILURE);
+    }
+    if (strcmp(argv[ai], "-h") == 0) {
+      std::cout << "Here is the help! Usage:" << std::endl;
+      printHelp();
+      exit(EXIT_FAILURE);
+    } else if (ai + 1 >= argc) {
+      std::cout << "Missing value of " << argv[ai] << "! Usage:" << std::endl;
+      printHelp();
+      exit(EXIT_FAILURE);
+    } else if (strcmp(argv[ai], "-output") == 0) {
+      output_ = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-patients") == 0) {
+      patients_ = atoll(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-vocab") == 0) {
+      vocab_ = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-zipf") == 0) {
+      zipf_ = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-visits") == 0) {
+      visits_ = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-codes") == 0) {
+      codes_ = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-gap") == 0) {
+      gap_ = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-gapDist") == 0) {
+      std::string dist(argv[ai + 1]);
+      if (dist == "exp") {
+        gapDist_ = gap_dist::exp;
+      } else if (dist == "uniform") {
+        gapDist_ = gap_dist::uniform;
+      } else if (dist == "fixed") {
+        gapDist_ = gap_dist::fixed;
+      } else {
+        std::cout << "Unknown gap distribution: " << dist << std::endl;
+        printHelp();
+        exit(EXIT_FAILURE);
+      }
+    } else if (strcmp(argv[ai], "-start") == 0) {
+      start_ = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-cluster") == 0) {
+      cluster_ = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-coherence") == 0) {
+      coherence_ = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-thread") == 0) {
+      thread_ = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-seed") == 0) {
+      seed_ = strtoull(argv[ai + 1], nullptr, 10);
+    } else if (strcmp(argv[ai], "-verbose") == 0) {
+      verbose_ = atoi(argv[ai + 1]);
+    } else {
+      std::cout << "Unknown argument: " << argv[ai] << std::endl;
+      printHelp();
+      exit(EXIT_FAILURE);
+    }
+    ai += 2;
+  }
+  if (output_.empty()) {
+    std::cout << "Empty output path." << std::endl;
+    printHelp();
+    exit(EXIT_FAILURE);
+  }
+  if (patients_ < 1 || vocab_ < 1 || visits_ < 1 || codes_ < 1 || gap_ < 0 ||
+      thread_ < 1) {
+    std::cout << "-patients, -vocab, -visits, -codes and -thread must be at "
+                 "least 1, and -gap at least 0." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (cluster_ < 0 || cluster_ > vocab_ || coherence_ < 0 || coherence_ > 1) {
+    std::cout << "-cluster must be between 0 and -vocab, and -coherence "
+                 "between 0 and 1." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+void Generator::printHelp() {
+  std::cout
+      << "\n"
+      << "usage: mce gen-data -output <file> <args>\n\n"
+      << "The following arguments are mandatory:\n"
+      << "  -output             EMR file path, - for stdout\n\n"
+      << "The following arguments are optional:\n"
+      << "  -patients           number of patients (lines) [" << patients_
+      << "]\n"
+      << "  -vocab              number of distinct concepts [" << vocab_
+      << "]\n"
+      << "  -zipf               exponent of the Zipf law of the concepts ["
+      << zipf_ << "]\n"
+      << "  -visits             mean number of visits per patient [" << visits_
+      << "]\n"
+      << "  -codes              mean number of codes per visit [" << codes_
+      << "]\n"
+      << "  -gap                mean number of days between visits [" << gap_
+      << "]\n"
+      << "  -gapDist            distribution of the gaps {exp, uniform, fixed} "
+         "[exp]\n"
+      << "  -start              earliest first visit, unix time [" << std::fixed
+      << std::setprecision(0) << start_ << "]\n"
+      << "  -cluster            size of the planted groups of co-occurring "
+         "concepts, 0 for none [" << cluster_ << "]\n"
+      << "  -coherence          probability that a code is from the group of "
+         "its visit [" << std::setprecision(2) << coherence_ << "]\n"
+      << "  -thread             number of threads [" << thread_ << "]\n"
+      << "  -seed               seed of the random draws [" << seed_ << "]\n"
+      << "  -verbose            verbosity level [" << verbose_ << "]\n"
+      << std::endl;
+}
+
+/*
+  draw: index drawn from cumulative weights, by binary search.
+*/
+int32_t Generator::draw(const std::vector<double>& cdf, Rng& rng) const {
+  double u = (double(rng()) + rng.uniform()) / 4294967296.0 * cdf.back();
+  return std::min(int32_t(std::upper_bound(cdf.begin(), cdf.end(), u) -
+                          cdf.begin()),
+                  int32_t(cdf.size()) - 1);
+}
+
+/*
+  count: at least 1, geometric with the given mean.
+*/
+int32_t Generator::count(double mean, Rng& rng) const {
+  double p = 1.0 / mean;
+  double u = 1.0 - rng.uniform();
+  return 1 + int32_t(std::log(u) / std::log(1.0 - std::min(p, 0.999999)));
+}
+
+/*
+  gap: seconds between two visits.
+*/
+double Generator::gap(Rng& rng) const {
+  double days = gap_;
+  if (gapDist_ == gap_dist::exp) {
+    days = -gap_ * std::log(1.0 - rng.uniform());
+  } else if (gapDist_ == gap_dist::uniform) {
+    days = 2.0 * gap_ * rng.uniform();
+  }
+  return days * 86400.0;
+}
+
+/*
+  patient: append the line of a patient to line.
+*/
+void Generator::patient(int64_t id, Rng& rng, std::string& line,
+                        int64_t& nvisits, int64_t& ncodes) const {
+  char buffer[32];
+  appendInt(line, id);
+  line += ", [";
+  double time = start_ + 365.0 * 86400.0 * rng.uniform();
+  int32_t visits = count(visits_, rng);
+  for (int32_t v = 0; v < visits; v++) {
+    if (v > 0) {
+      time += gap(rng);
+      line += ", ";
+    }
+    snprintf(buffer, sizeof(buffer), "[%.1f, [", time);
+    line += buffer;
+    int32_t group = cluster_ > 0 ? draw(clusterCdf_, rng) : 0;
+    int32_t codes = count(codes_, rng);
+    for (int32_t c = 0; c < codes; c++) {
+      int32_t concept;
+      if (cluster_ > 0 && rng.uniform() < coherence_) {
+        concept = members_[int64_t(group) * cluster_ + rng.bounded(cluster_)];
+      } else {
+        concept = draw(cdf_, rng);
+      }
+      if (c > 0) {
+        line += ", ";
+      }
+      appendInt(line, concept);
+    }
+    line += "]]";
+    ncodes += codes;
+  }
+  line += "]\n";
+  nvisits += visits;
+}
+
+/*
+  generateThread: generate the chunks threadId, threadId + -thread, ...
+  and write each one after the previous chunk.
+*/
+void Generator::generateThread(int32_t threadId) {
+  const int64_t nchunks = (patients_ + CHUNK_SIZE - 1) / CHUNK_SIZE;
+  std::string text;
+  for (int64_t chunk = threadId; chunk < nchunks; chunk += thread_) {
+    Rng rng(seed_);
+    rng.setStream(chunk);
+    rng.seed(seed_);
+    text.clear();
+    int64_t nvisits = 0, ncodes = 0;
+    int64_t end = std::min(patients_, (chunk + 1) * CHUNK_SIZE);
+    for (int64_t id = chunk * CHUNK_SIZE; id < end; id++) {
+      patient(id, rng, text, nvisits, ncodes);
+    }
+    std::unique_lock<std::mutex> lock(writeMutex_);
+    written_.wait(lock, [&]() { return nextChunk_ == chunk; });
+    out_->write(text.data(), text.size());
+    if (!out_->good()) {
+      std::cerr << "\nOutput file cannot be written!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    bytes_ += text.size();
+    nvisits_ += nvisits;
+    ncodes_ += ncodes;
+    nextChunk_++;
+    if (verbose_ > 1 && (nextChunk_ % 16 == 0 || nextChunk_ == nchunks)) {
+      std::cerr << "\rPatients: " << std::min(patients_, nextChunk_ * CHUNK_SIZE)
+                << "  size: " << std::fixed << std::setprecision(1)
+                << bytes_ / 1e6 << "MB" << std::flush;
+    }
+    written_.notify_all();
+  }
+}
+
+void Generator::saveClusters() const {
+  std::string filename = output_ + ".clusters";
+  std::ofstream ofs(filename);
+  if (!ofs.is_open()) {
+    std::cerr << "Clusters file cannot be opened for saving!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  for (size_t i = 0; i < members_.size(); i += cluster_) {
+    for (int32_t j = 0; j < cluster_; j++) {
+      ofs << (j > 0 ? " " : "") << members_[i + j];
+    }
+    ofs << std::endl;
+  }
+}
+
+void Generator::generate() {
+  auto begin = std::chrono::steady_clock::now();
+  cdf_.resize(vocab_);
+  double sum = 0.0;
+  for (int32_t i = 0; i < vocab_; i++) {
+    sum += std::pow(double(i + 1), -zipf_);
+    cdf_[i] = sum;
+  }
+  if (cluster_ > 0) {
+    // random groups, whose popularity follows the same Zipf law
+    int32_t nclusters = vocab_ / cluster_;
+    members_.resize(int64_t(nclusters) * cluster_);
+    std::vector<int32_t> perm(vocab_);
+    for (int32_t i = 0; i < vocab_; i++) perm[i] = i;
+    Rng rng(seed_ ^ 0x636c7573ULL);
+    for (int32_t i = vocab_ - 1; i > 0; i--) {
+      std::swap(perm[i], perm[rng.bounded(i + 1)]);
+    }
+    std::copy(perm.begin(), perm.begin() + members_.size(), members_.begin());
+    clusterCdf_.resize(nclusters);
+    sum = 0.0;
+    for (int32_t i = 0; i < nclusters; i++) {
+      sum += std::pow(double(i + 1), -zipf_);
+      clusterCdf_[i] = sum;
+    }
+  }
+
+  std::ofstream ofs;
+  out_ = &std::cout;
+  if (output_ != "-") {
+    ofs.open(output_, std::ios::binary);
+    if (!ofs.is_open()) {
+      std::cerr << "Output file cannot be opened for saving!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    out_ = &ofs;
+  }
+  nextChunk_ = 0;
+  bytes_ = nvisits_ = ncodes_ = 0;
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < thread_; i++) {
+    threads.push_back(std::thread([=]() { generateThread(i); }));
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  out_->flush();
+  if (cluster_ > 0 && output_ != "-") {
+    saveClusters();
+  }
+  if (verbose_ > 0) {
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - begin).count();
+    std::cerr << "\rPatients: " << patients_ << "  visits: " << nvisits_
+              << "  codes: " << ncodes_ << "  size: " << std::fixed
+              << std::setprecision(1) << bytes_ / 1e6 << "MB  time: "
+              << seconds << "s  (" << bytes_ / 1e6 / seconds << "MB/s)"
+              << std::endl;
+  }
+}
+}
@@ -0,0 +1,87 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_GENERATOR_H
+#define FASTTEXT_GENERATOR_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "rng.h"
+
+namespace fasttext {
+
+enum class gap_dist : int { exp = 1, uniform, fixed };
+
+/*
+  Generator: synthetic EMR files (gen-data), one patient per line in the
+  format read by Dictionary::getLineContext:
+    pid, [[timestamp, [c1, c2, ...]], [timestamp, [...]], ...]
+  Concepts are integers drawn from a Zipf distribution. With -cluster k,
+  the concepts are also split into random groups of k: each visit draws a
+  group, and each of its codes comes from the group with probability
+  -coherence, so the members of a group co-occur. The groups are saved to
+  <output>.clusters, one per line, as the planted neighbors of each concept.
+  Patients are generated by chunks of CHUNK_SIZE, each from its own stream
+  of -seed, so the file only depends on the options and not on -thread.
+*/
+class Generator {
+ private:
+  static const int64_t CHUNK_SIZE = 4096;
+
+  std::string output_;
+  int64_t patients_;
+  int32_t vocab_;
+  double zipf_;
+  double visits_;
+  double codes_;
+  double gap_;
+  gap_dist gapDist_;
+  double start_;
+  int32_t cluster_;
+  double coherence_;
+  int32_t thread_;
+  uint64_t seed_;
+  int verbose_;
+
+  // cumulative Zipf weights of the concepts (or of the groups)
+  std::vector<double> cdf_;
+  std::vector<double> clusterCdf_;
+  // concept ids of the groups, cluster_ per group
+  std::vector<int32_t> members_;
+
+  // the chunks are written in order by the threads that generate them
+  std::ostream* out_;
+  int64_t nextChunk_;
+  int64_t bytes_;
+  int64_t nvisits_;
+  int64_t ncodes_;
+  std::mutex writeMutex_;
+  std::condition_variable written_;
+
+  int32_t draw(const std::vector<double>&, Rng&) const;
+  int32_t count(double, Rng&) const;
+  double gap(Rng&) const;
+  void patient(int64_t, Rng&, std::string&, int64_t&, int64_t&) const;
+  void generateThread(int32_t);
+  void saveClusters() const;
+
+ public:
+  Generator();
+  void parseArgs(int, char**);
+  void printHelp();
+  void generate();
+};
+}
+
+#endif
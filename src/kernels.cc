@@ -0,0 +1,86 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "kernels.h"
+
+namespace fasttext {
+
+namespace kernels {
+
+  // independent partial sums of dot, so that the reduction vectorizes
+  static const int64_t LANES = 8;
+
+  static inline real dotN(const real* x, const real* y, int64_t n) {
+    real lanes[LANES] = {0.0};
+    int64_t m = n - n % LANES;
+    for (int64_t j = 0; j < m; j += LANES) {
+      for (int64_t l = 0; l < LANES; l++) {
+        lanes[l] += x[j + l] * y[j + l];
+      }
+    }
+    real d = 0.0;
+    for (int64_t l = 0; l < LANES; l++) {
+      d += lanes[l];
+    }
+    for (int64_t j = m; j < n; j++) {
+      d += x[j] * y[j];
+    }
+    return d;
+  }
+
+  static inline void axpyN(real* y, real a, const real* x, int64_t n) {
+    for (int64_t j = 0; j < n; j++) {
+      y[j] += a * x[j];
+    }
+  }
+
+  static real dot(const real* x, const real* y, int64_t n) {
+    return dotN(x, y, n);
+  }
+
+  static void axpy(real* y, real a, const real* x, int64_t n) {
+    axpyN(y, a, x, n);
+  }
+
+  template <int64_t N>
+  static real dotFixed(const real* x, const real* y, int64_t) {
+    return dotN(x, y, N);
+  }
+
+  template <int64_t N>
+  static void axpyFixed(real* y, real a, const real* x, int64_t) {
+    axpyN(y, a, x, N);
+  }
+
+  template <int64_t N>
+  static RowKernels fixed() {
+    RowKernels k = {&dotFixed<N>, &axpyFixed<N>};
+    return k;
+  }
+
+  RowKernels rowKernels(int32_t dim) {
+    switch (dim) {
+      case 64:
+        return fixed<64>();
+      case 100:
+        return fixed<100>();
+      case 128:
+        return fixed<128>();
+      case 200:
+        return fixed<200>();
+      case 300:
+        return fixed<300>();
+      default:
+        RowKernels k = {&dot, &axpy};
+        return k;
+    }
+  }
+}
+
+}
@@ -0,0 +1,39 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_KERNELS_H
+#define FASTTEXT_KERNELS_H
+
+#include <cstdint>
+
+#include "real.h"
+
+namespace fasttext {
+
+/*
+  Row kernels of the training loop. For the common dimensions (64, 100,
+  128, 200, 300) the row length is a compile-time constant, so the loops are
+  fully unrolled and vectorized; other dimensions use the generic versions.
+  The kernels are picked once, when a Model is built.
+*/
+namespace kernels {
+
+  struct RowKernels {
+    // x . y
+    real (*dot)(const real* x, const real* y, int64_t n);
+    // y += a * x
+    void (*axpy)(real* y, real a, const real* x, int64_t n);
+  };
+
+  RowKernels rowKernels(int32_t dim);
+}
+
+}
+
+#endif
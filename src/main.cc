@@ -7,9 +7,17 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <sys/resource.h>
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <string>
+#include <vector>
 
 #include "args.h"
+#include "generator.h"
 #include "mce.h"
 
 using namespace fasttext;
@@ -19,7 +27,15 @@ void printUsage() {
             << "The commands supported by fasttext are:\n\n"
             << "  skipgram            train a skipgram model\n"
             << "  cbow                train a cbow model\n"
+            << "  attn1               train an attention model (context view)\n"
+            << "  attn2               train an attention model (feature view)\n"
+            << "  sweep               train one model per -grid configuration\n"
             << "  print-vectors       print vectors given a trained model\n"
+            << "  eval                loss of a trained model on a held-out "
+               "file\n"
+            << "  gen-data            write a synthetic EMR file\n"
+            << "  bench-quality       time attn2 to a recall on a synthetic "
+               "file\n"
             << std::endl;
 }
 
@@ -29,6 +45,33 @@ void printPrintVectorsUsage() {
             << std::endl;
 }
 
+void printEvalUsage() {
+  std::cout << "usage: mce eval <model> <test-data> [<thread>]\n\n"
+            << "  <model>      attn1 or attn2 model filename\n"
+            << "  <test-data>  held-out EMR file\n"
+            << "  <thread>     number of threads (default 12)\n"
+            << std::endl;
+}
+
+void eval(int argc, char** argv) {
+  if (argc < 4 || argc > 5) {
+    printEvalUsage();
+    exit(EXIT_FAILURE);
+  }
+  int32_t threads = 12;
+  if (argc == 5) {
+    threads = atoi(argv[4]);
+  }
+  if (threads < 1) {
+    printEvalUsage();
+    exit(EXIT_FAILURE);
+  }
+  FastText fasttext;
+  fasttext.loadModel(std::string(argv[2]));
+  fasttext.eval(std::string(argv[3]), threads);
+  exit(0);
+}
+
 void printVectors(int argc, char** argv) {
   if (argc != 3) {
     printPrintVectorsUsage();
@@ -43,10 +86,117 @@ void printVectors(int argc, char** argv) {
 void train(int argc, char** argv) {
   std::shared_ptr<Args> a = std::make_shared<Args>();
   a->parseArgs(argc, argv);
+  if (!a->grid.empty()) {
+    std::cerr << "-grid is an option of sweep." << std::endl;
+    exit(EXIT_FAILURE);
+  }
   FastText fasttext;
   fasttext.train(a);
 }
 
+void sweep(int argc, char** argv) {
+  if (argc < 3) {
+    std::cout << "usage: mce sweep <attn1|attn2|skipgram|cbow> -grid "
+                 "\"dim=64,100 neg=5,10\" <args>" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::shared_ptr<Args> a = std::make_shared<Args>();
+  // the command of the models follows sweep
+  a->parseArgs(argc - 1, argv + 1);
+  if (a->grid.empty()) {
+    std::cerr << "sweep requires -grid." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  FastText fasttext;
+  fasttext.sweep(a);
+}
+
+void genData(int argc, char** argv) {
+  Generator generator;
+  generator.parseArgs(argc, argv);
+  generator.generate();
+}
+
+/*
+  benchQuality: generate the fixed synthetic EMR file of QUALITY_CORPUS,
+  with planted groups of co-occurring concepts, and train attn2 on it until
+  the vectors find the groups with -targetRecall. Reports the wall-clock
+  time to the target and the peak RSS, to <output>.bench.json too.
+*/
+const char* const QUALITY_CORPUS[] = {
+    "-patients", "50000", "-vocab", "5000", "-zipf", "1.0", "-visits", "10",
+    "-codes", "5", "-gap", "10", "-cluster", "10", "-coherence", "0.5",
+    "-seed", "1"};
+const double QUALITY_TARGET = 0.7;
+
+void benchQuality(int argc, char** argv) {
+  if (argc < 4) {
+    std::cout << "usage: mce bench-quality -output <prefix> <attn2 args>"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::shared_ptr<Args> a = std::make_shared<Args>();
+  std::string emr;
+  for (int ai = 2; ai + 1 < argc; ai += 2) {
+    if (std::string(argv[ai]) == "-output") {
+      emr = std::string(argv[ai + 1]) + ".emr";
+    }
+  }
+  std::vector<std::string> args = {argv[0], "attn2", "-input", emr,
+                                   "-neighbors", emr + ".clusters",
+                                   "-targetRecall",
+                                   std::to_string(QUALITY_TARGET),
+                                   "-recallInterval", "1", "-epoch", "20"};
+  args.insert(args.end(), argv + 2, argv + argc);
+  std::vector<char*> cargs;
+  for (auto& arg : args) {
+    cargs.push_back(&arg[0]);
+  }
+  a->parseArgs(cargs.size(), cargs.data());
+
+  std::vector<std::string> gen = {argv[0], "gen-data", "-output", emr,
+                                  "-thread", std::to_string(a->thread),
+                                  "-verbose", std::to_string(a->verbose)};
+  gen.insert(gen.end(), std::begin(QUALITY_CORPUS), std::end(QUALITY_CORPUS));
+  std::vector<char*> cgen;
+  for (auto& arg : gen) {
+    cgen.push_back(&arg[0]);
+  }
+  Generator generator;
+  generator.parseArgs(cgen.size(), cgen.data());
+  generator.generate();
+
+  auto begin = std::chrono::steady_clock::now();
+  FastText fasttext;
+  fasttext.train(a);
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin).count();
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // kilobytes on Linux
+  double rss = usage.ru_maxrss / 1024.0;
+
+  std::ofstream ofs(a->output + ".bench.json");
+  if (!ofs.is_open()) {
+    std::cerr << "Bench file cannot be opened for saving!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  for (std::ostream* out : {static_cast<std::ostream*>(&ofs), &std::cout}) {
+    *out << std::fixed << std::setprecision(3) << "{\"target_recall\": "
+         << a->targetRecall << ", \"time_to_target\": ";
+    if (fasttext.targetTime() >= 0) {
+      *out << fasttext.targetTime();
+    } else {
+      *out << "null";
+    }
+    *out << ", \"recall\": " << fasttext.recall()
+         << ", \"train_sec\": " << seconds << ", \"threads\": "
+         << a->thread << ", \"dim\": " << a->dim
+         << ", \"peak_rss_mb\": " << std::setprecision(1) << rss << "}"
+         << std::endl;
+  }
+}
+
 int main(int argc, char** argv) {
   if (argc < 2) {
     printUsage();
@@ -56,8 +206,16 @@ int main(int argc, char** argv) {
   if (command == "skipgram" || command == "cbow" || command == "attn1" ||
       command == "attn2") {
     train(argc, argv);
+  } else if (command == "sweep") {
+    sweep(argc, argv);
   } else if (command == "print-vectors") {
     printVectors(argc, argv);
+  } else if (command == "eval") {
+    eval(argc, argv);
+  } else if (command == "gen-data") {
+    genData(argc, argv);
+  } else if (command == "bench-quality") {
+    benchQuality(argc, argv);
   } else {
     printUsage();
     exit(EXIT_FAILURE);
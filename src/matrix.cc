@@ -22,18 +22,31 @@ Matrix::Matrix() {
   m_ = 0;
   n_ = 0;
   data_ = nullptr;
+  owner_ = true;
 }
 
 Matrix::Matrix(int64_t m, int64_t n) {
   m_ = m;
   n_ = n;
   data_ = new real[m * n];
+  owner_ = true;
+}
+
+/*
+  Matrix: a m x n view of data, which is not freed with the matrix.
+*/
+Matrix::Matrix(int64_t m, int64_t n, real* data) {
+  m_ = m;
+  n_ = n;
+  data_ = data;
+  owner_ = false;
 }
 
 Matrix::Matrix(const Matrix& other) {
   m_ = other.m_;
   n_ = other.n_;
   data_ = new real[m_ * n_];
+  owner_ = true;
   for (int64_t i = 0; i < (m_ * n_); i++) {
     data_[i] = other.data_[i];
   }
@@ -44,10 +57,13 @@ Matrix& Matrix::operator=(const Matrix& other) {
   m_ = temp.m_;
   n_ = temp.n_;
   std::swap(data_, temp.data_);
+  std::swap(owner_, temp.owner_);
   return *this;
 }
 
-Matrix::~Matrix() { delete[] data_; }
+Matrix::~Matrix() {
+  if (owner_) delete[] data_;
+}
 
 void Matrix::zero() {
   for (int64_t i = 0; i < (m_ * n_); i++) {
@@ -92,8 +108,9 @@ void Matrix::save(std::ostream& out) {
 void Matrix::load(std::istream& in) {
   in.read((char*)&m_, sizeof(int64_t));
   in.read((char*)&n_, sizeof(int64_t));
-  delete[] data_;
+  if (owner_) delete[] data_;
   data_ = new real[m_ * n_];
+  owner_ = true;
   in.read((char*)data_, m_ * n_ * sizeof(real));
 }
 
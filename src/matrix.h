@@ -25,9 +25,12 @@ class Matrix {
   real* data_;
   int64_t m_;
   int64_t n_;
+  // false for a view of memory owned elsewhere (-workers)
+  bool owner_;
 
   Matrix();
   Matrix(int64_t, int64_t);
+  Matrix(int64_t, int64_t, real*);
   Matrix(const Matrix&);
   Matrix& operator=(const Matrix&);
   real& operator()(int64_t, int64_t);
@@ -10,12 +10,23 @@
 #include "mce.h"
 
 #include <math.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <iomanip>
 #include <iostream>
+#include <new>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
@@ -66,10 +77,282 @@ void FastText::saveModel() {
   input_->save(ofs);
   output_->save(ofs);
   attn_->save(ofs);
+  if (args_->attnrank > 0) {
+    attnOffset_->save(ofs);
+  }
   bias_->save(ofs);
   ofs.close();
 }
 
+void FastText::saveProgress(std::ostream& out) {
+  out.write((char*)&trainTokens_, sizeof(int64_t));
+  out.write((char*)&initWords_, sizeof(int64_t));
+  out.write((char*)&(args_->thread), sizeof(int));
+  for (int32_t i = 0; i < args_->thread; i++) {
+    int64_t pos = threadPos_[i], tokens = threadTokens_[i];
+    out.write((char*)&pos, sizeof(int64_t));
+    out.write((char*)&tokens, sizeof(int64_t));
+  }
+}
+
+void FastText::loadProgress(std::istream& in) {
+  in.read((char*)&trainTokens_, sizeof(int64_t));
+  in.read((char*)&initWords_, sizeof(int64_t));
+  int thread;
+  in.read((char*)&thread, sizeof(int));
+  if (thread != args_->thread) {
+    std::cerr << "Checkpoint was written with -thread " << thread
+              << ", resume it with the same number of threads." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  for (int32_t i = 0; i < args_->thread; i++) {
+    int64_t pos, tokens;
+    in.read((char*)&pos, sizeof(int64_t));
+    in.read((char*)&tokens, sizeof(int64_t));
+    threadPos_[i] = pos;
+    threadTokens_[i] = tokens;
+  }
+}
+
+/*
+  saveCheckpoint: write a checkpoint of the training to <output>.ckpt. The
+  first checkpoint of a run, and any checkpoint after the log grew larger
+  than the base, writes a new base (progress, args, dictionary and all the
+  parameters) and starts an empty log, <output>.ckpt.log. The other
+  checkpoints append to the log the progress and the rows written since the
+  previous checkpoint. Log records carry the generation of their base, so a
+  crash between the new base and the truncation of the log is harmless.
+  While training runs, the rows are copied as the threads update them (like
+  Hogwild reads); the progress is recorded first, so a resumed run may train
+  again a few lines whose updates were already saved.
+*/
+void FastText::saveCheckpoint() {
+  std::string filename = args_->output + ".ckpt";
+  if (ckptBaseBytes_ == 0 || ckptLogBytes_ > ckptBaseBytes_) {
+    // rows written from now on go to the next delta
+    dirtyInput_->clear();
+    dirtyOutput_->clear();
+    dirtyAttn_->clear();
+    ckptGeneration_++;
+    std::ofstream ofs(filename + ".tmp", std::ofstream::binary);
+    if (!ofs.is_open()) {
+      std::cerr << "Checkpoint file cannot be opened for saving!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    ofs.write((char*)&ckptGeneration_, sizeof(int64_t));
+    saveProgress(ofs);
+    args_->save(ofs);
+    dict_->save(ofs);
+    input_->save(ofs);
+    output_->save(ofs);
+    attn_->save(ofs);
+    if (args_->attnrank > 0) {
+      attnOffset_->save(ofs);
+    }
+    bias_->save(ofs);
+    ckptBaseBytes_ = ofs.tellp();
+    ofs.close();
+    std::rename((filename + ".tmp").c_str(), filename.c_str());
+    std::ofstream log(filename + ".log", std::ofstream::binary);
+    ckptLogBytes_ = 0;
+    return;
+  }
+  std::fstream log(filename + ".log", std::fstream::in | std::fstream::out |
+                                          std::fstream::binary);
+  if (!log.is_open()) {
+    std::cerr << "Checkpoint file cannot be opened for saving!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  log.seekp(0, std::ios::end);
+  int64_t begin = log.tellp();
+  int64_t bytes = 0;
+  log.write((char*)&ckptGeneration_, sizeof(int64_t));
+  log.write((char*)&bytes, sizeof(int64_t));
+  saveProgress(log);
+  checkpoint::saveRows(log, *input_, *dirtyInput_);
+  checkpoint::saveRows(log, *output_, *dirtyOutput_);
+  checkpoint::saveRows(log, *attn_, *dirtyAttn_);
+  if (args_->attnrank > 0) {
+    log.write((char*)attnOffset_->data_,
+              attnOffset_->m_ * attnOffset_->n_ * sizeof(real));
+  }
+  log.write((char*)bias_->data_, bias_->m_ * sizeof(real));
+  int64_t end = log.tellp();
+  bytes = end - begin - 2 * sizeof(int64_t);
+  log.seekp(begin + sizeof(int64_t));
+  log.write((char*)&bytes, sizeof(int64_t));
+  log.close();
+  ckptLogBytes_ = end;
+}
+
+/*
+  loadCheckpoint: restore the dictionary, the parameters and the progress
+  of every thread from a checkpoint base and the complete records of its
+  log. The architecture options must match the ones of the checkpoint.
+*/
+void FastText::loadCheckpoint(const std::string& filename) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    std::cerr << "Checkpoint file cannot be opened for loading!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  ifs.read((char*)&ckptGeneration_, sizeof(int64_t));
+  loadProgress(ifs);
+  Args saved;
+  saved.load(ifs);
+  if (saved.dim != args_->dim || saved.attnws != args_->attnws ||
+      saved.attnrank != args_->attnrank || saved.model != args_->model ||
+      saved.loss != args_->loss) {
+    std::cerr << "Checkpoint does not match the model, -loss, -dim, -attnws "
+                 "or -attnrank options." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  dict_->load(ifs);
+  input_ = std::make_shared<Matrix>();
+  output_ = std::make_shared<Matrix>();
+  attn_ = std::make_shared<Matrix>();
+  attnOffset_ = std::make_shared<Matrix>();
+  bias_ = std::make_shared<Vector>(2 * args_->attnws + 1);
+  input_->load(ifs);
+  output_->load(ifs);
+  attn_->load(ifs);
+  if (args_->attnrank > 0) {
+    attnOffset_->load(ifs);
+  }
+  bias_->load(ifs);
+  ifs.close();
+
+  int32_t records = 0;
+  std::ifstream log(filename + ".log", std::ifstream::binary);
+  if (log.is_open()) {
+    int64_t size = utils::size(log);
+    int64_t pos = 0;
+    while (pos + 2 * int64_t(sizeof(int64_t)) <= size) {
+      int64_t generation, bytes;
+      log.seekg(pos);
+      log.read((char*)&generation, sizeof(int64_t));
+      log.read((char*)&bytes, sizeof(int64_t));
+      int64_t next = pos + 2 * sizeof(int64_t) + bytes;
+      // the last record may be incomplete after a crash
+      if (bytes <= 0 || next > size) break;
+      if (generation == ckptGeneration_) {
+        loadProgress(log);
+        checkpoint::loadRows(log, *input_);
+        checkpoint::loadRows(log, *output_);
+        checkpoint::loadRows(log, *attn_);
+        if (args_->attnrank > 0) {
+          log.read((char*)attnOffset_->data_,
+                   attnOffset_->m_ * attnOffset_->n_ * sizeof(real));
+        }
+        log.read((char*)bias_->data_, bias_->m_ * sizeof(real));
+        records++;
+      }
+      pos = next;
+    }
+    log.close();
+  }
+  resumed_ = true;
+  if (args_->verbose > 0) {
+    int64_t tokens = 0;
+    for (int32_t i = 0; i < args_->thread; i++) {
+      tokens += threadTokens_[i];
+    }
+    std::cout << "Resumed from " << filename << " (" << records
+              << " incremental checkpoints), " << tokens << " tokens trained"
+              << std::endl;
+  }
+}
+
+/*
+  checkpointLoop: body of the checkpoint writer thread, which saves a
+  checkpoint every -checkpoint seconds until the training threads finish.
+*/
+void FastText::checkpointLoop() {
+  std::unique_lock<std::mutex> lock(doneMutex_);
+  while (!doneCv_.wait_for(lock, std::chrono::seconds(args_->checkpoint),
+                           [this]() { return trainingDone_; })) {
+    saveCheckpoint();
+  }
+}
+
+/*
+  setShard: restrict the training of this node to its part of the input
+  (-nodes), about 1 / nodes of the bytes cut at line boundaries. An epoch
+  is then the tokens of the part, estimated from its share of the bytes.
+*/
+void FastText::setShard() {
+  std::ifstream ifs(args_->input);
+  int64_t size = utils::size(ifs);
+  utils::seekToBOS(ifs, args_->rank * size / args_->nodes);
+  shardBegin_ = ifs.tellg();
+  if (args_->rank + 1 < args_->nodes) {
+    utils::seekToBOS(ifs, (args_->rank + 1) * size / args_->nodes);
+    shardEnd_ = ifs.tellg();
+  } else {
+    shardEnd_ = size;
+  }
+  trainTokens_ = std::max(int64_t(1), int64_t(double(trainTokens_) *
+                                              (shardEnd_ - shardBegin_) / size));
+}
+
+/*
+  startSync: connect to the other nodes (-nodes). The nodes check that
+  they start from the same dictionary and parameters, which the
+  deterministic initialization gives when they read the same input.
+*/
+void FastText::startSync() {
+  bias2d_ = std::make_shared<Matrix>(1, bias_->m_, bias_->data_);
+  std::vector<std::shared_ptr<Matrix>> params = {input_, output_, attn_,
+                                                 attnOffset_, bias2d_};
+  std::vector<std::shared_ptr<DirtyRows>> dirty(params.size());
+  if (args_->syncRows) {
+    dirtyInput_ = std::make_shared<DirtyRows>(input_->m_);
+    dirtyOutput_ = std::make_shared<DirtyRows>(output_->m_);
+    dirtyAttn_ = std::make_shared<DirtyRows>(attn_->m_);
+    dirty[0] = dirtyInput_;
+    dirty[1] = dirtyOutput_;
+    dirty[2] = dirtyAttn_;
+  }
+  std::vector<int64_t> check = {dict_->nwords(), dict_->ntokens()};
+  for (auto& p : params) {
+    double sum = 0.0;
+    for (int64_t i = 0; i < p->m_ * p->n_; i++) {
+      sum += p->data_[i];
+    }
+    int64_t bits;
+    memcpy(&bits, &sum, sizeof(int64_t));
+    check.push_back(p->m_);
+    check.push_back(p->n_);
+    check.push_back(bits);
+  }
+  sync_ = std::make_shared<ParameterSync>(args_, params, dirty);
+  if (args_->verbose > 0) {
+    std::cout << "Sync: rank " << args_->rank << " of " << args_->nodes
+              << ", connecting to " << args_->master << std::endl;
+  }
+  sync_->connect(check);
+}
+
+/*
+  syncLoop: body of the sync thread, which averages the parameters with
+  the other nodes every -syncInterval seconds, and once more after the
+  training, until the training is over on all the nodes.
+*/
+void FastText::syncLoop() {
+  bool allDone = false;
+  while (!allDone) {
+    bool done;
+    {
+      std::unique_lock<std::mutex> lock(doneMutex_);
+      doneCv_.wait_for(lock,
+                       std::chrono::duration<double>(args_->syncInterval),
+                       [this]() { return trainingDone_; });
+      done = trainingDone_;
+    }
+    allDone = sync_->round(done);
+  }
+}
+
 void FastText::loadModel(const std::string& filename) {
   std::ifstream ifs(filename, std::ifstream::binary);
   if (!ifs.is_open()) {
@@ -86,12 +369,16 @@ void FastText::loadModel(std::istream& in) {
   input_ = std::make_shared<Matrix>();
   output_ = std::make_shared<Matrix>();
   attn_ = std::make_shared<Matrix>();
+  attnOffset_ = std::make_shared<Matrix>();
   bias_ = std::make_shared<Vector>(args_->dim);
   args_->load(in);
   dict_->load(in);
   input_->load(in);
   output_->load(in);
   attn_->load(in);
+  if (args_->attnrank > 0) {
+    attnOffset_->load(in);
+  }
   bias_->load(in);
   // initialize attn and bias
   /*
@@ -102,7 +389,8 @@ void FastText::loadModel(std::istream& in) {
   }
   // ws = args_->ws;
   */
-  model_ = std::make_shared<Model>(input_, output_, attn_, bias_, args_, 0);
+  model_ = std::make_shared<Model>(input_, output_, attn_, attnOffset_, bias_,
+                                   args_, 0);
   if (args_->model == model_name::sup) {
     model_->setTargetCounts(dict_->getCounts(entry_type::label));
   } else {
@@ -110,14 +398,50 @@ void FastText::loadModel(std::istream& in) {
   }
 }
 
-void FastText::printInfo(real progress, real loss) {
-  real t = real(clock() - start) / CLOCKS_PER_SEC;
-  real wst = real(tokenCount) / t;
+/*
+  elapsed: wall-clock seconds since the threads started.
+*/
+real FastText::elapsed() const {
+  return std::chrono::duration<real>(std::chrono::steady_clock::now() -
+                                     start_).count();
+}
+
+/*
+  meanLoss: mean of the losses of the threads that reported one.
+*/
+real FastText::meanLoss() const {
+  real loss = 0.0;
+  int32_t n = 0;
+  for (int32_t i = 0; i < threads(); i++) {
+    if (threadLoss_[i] > 0) {
+      loss += threadLoss_[i];
+      n++;
+    }
+  }
+  return n > 0 ? loss / n : 0.0;
+}
+
+void FastText::printInfo(real progress) {
+  real t = elapsed();
+  real wst = real(*tokenCount_ - startTokens_) / t / threads();
   real lr = args_->lr * (1.0 - progress);
-  int eta = int(t / progress * (1 - progress) / args_->thread);
+  real loss = meanLoss();
+  // progress made by this run (not 0 when resumed)
+  std::cout << std::fixed;
+  if (args_->input == "-") {
+    // streaming: no known end, the learning rate is constant
+    std::cout << "\rRead: " << std::setprecision(1) << *tokenCount_ / 1e6
+              << "M words";
+    std::cout << "  words/sec/thread: " << std::setprecision(0) << wst;
+    std::cout << "  lr: " << std::setprecision(6) << args_->lr;
+    std::cout << "  loss: " << std::setprecision(6) << loss;
+    std::cout << std::flush;
+    return;
+  }
+  real done = progress - real(startTokens_) / (args_->epoch * trainTokens_);
+  int eta = done > 0 ? int(t / done * (1 - progress)) : 0;
   int etah = eta / 3600;
   int etam = (eta - etah * 3600) / 60;
-  std::cout << std::fixed;
   std::cout << "\rProgress: " << std::setprecision(1) << 100 * progress << "%";
   std::cout << "  words/sec/thread: " << std::setprecision(0) << wst;
   std::cout << "  lr: " << std::setprecision(6) << lr;
@@ -126,11 +450,424 @@ void FastText::printInfo(real progress, real loss) {
   std::cout << std::flush;
 }
 
+/*
+  openMetrics: open the -metrics file (<metrics>.<rank> for the ranks other
+  than 0 of -nodes), to which writeMetrics appends a JSON record.
+*/
+void FastText::openMetrics() {
+  if (args_->metrics.empty()) {
+    return;
+  }
+  std::string path = args_->metrics;
+  if (args_->nodes > 1 && args_->rank > 0) {
+    path += "." + std::to_string(args_->rank);
+  }
+  metrics_.open(path);
+  if (!metrics_.is_open()) {
+    std::cerr << "Metrics file cannot be opened for saving!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  lastMetrics_ = start_;
+}
+
+/*
+  writeMetrics: append a record of the training to the -metrics file, at
+  most every -metricsInterval seconds unless it is the last one. Throughput
+  is over the wall-clock time of this run; the times of the threads are
+  split into parsing the input and computing the updates.
+*/
+void FastText::writeMetrics(real progress, bool last) {
+  if (!metrics_.is_open()) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (!last && std::chrono::duration<double>(now - lastMetrics_).count() <
+                   args_->metricsInterval) {
+    return;
+  }
+  lastMetrics_ = now;
+  real t = elapsed();
+  real wps = real(*tokenCount_ - startTokens_) / t;
+  real lr = args_->input == "-" ? args_->lr : args_->lr * (1.0 - progress);
+  int32_t nthreads = threads();
+  double parse = 0.0, compute = 0.0;
+  for (int32_t i = 0; i < nthreads; i++) {
+    parse += threadParse_[i] / 1e9;
+    compute += threadCompute_[i] / 1e9;
+  }
+  metrics_ << std::fixed << std::setprecision(3) << "{\"time\": " << t
+           << ", \"progress\": " << std::setprecision(6) << progress
+           << ", \"tokens\": " << *tokenCount_
+           << ", \"words_per_sec\": " << std::setprecision(0) << wps
+           << ", \"words_per_sec_thread\": " << wps / nthreads
+           << ", \"lr\": " << std::setprecision(6) << lr
+           << ", \"loss\": " << meanLoss()
+           << ", \"parse_sec\": " << std::setprecision(3) << parse
+           << ", \"compute_sec\": " << compute;
+  if (neighbors_) {
+    metrics_ << ", \"recall\": " << std::setprecision(4) << recall_;
+  }
+  if (evaluator_) {
+    metrics_ << ", \"test_loss\": " << std::setprecision(6) << testLoss_;
+  }
+  metrics_ << std::setprecision(3) << ", \"threads\": [";
+  for (int32_t i = 0; i < nthreads; i++) {
+    metrics_ << (i > 0 ? ", " : "") << "{\"tokens\": " << threadTokens_[i]
+             << ", \"loss\": " << std::setprecision(6) << threadLoss_[i]
+             << ", \"parse_sec\": " << std::setprecision(3)
+             << threadParse_[i] / 1e9
+             << ", \"compute_sec\": " << threadCompute_[i] / 1e9 << "}";
+  }
+  metrics_ << "]" << (last ? ", \"done\": true" : "") << "}" << std::endl;
+}
+
+/*
+  initPerf: check that the hardware counters of -perf can be opened. When
+  they cannot, the training goes on without them.
+*/
+void FastText::initPerf() {
+  perf_ = false;
+  perfDict_ = perfTrain_ = perfSave_ = PerfCounters::Counts();
+  if (!args_->perf) {
+    return;
+  }
+  PerfCounters counters;
+  perf_ = counters.available();
+  if (!perf_) {
+    std::cerr << "Hardware counters are unavailable (" << counters.error()
+              << "), -perf is ignored." << std::endl;
+  }
+}
+
+/*
+  startPerf: counters of the calling thread, started, or null without
+  -perf. stopPerf adds what they counted to a phase.
+*/
+std::unique_ptr<PerfCounters> FastText::startPerf() const {
+  std::unique_ptr<PerfCounters> perf;
+  if (perf_) {
+    perf.reset(new PerfCounters());
+    perf->start();
+  }
+  return perf;
+}
+
+void FastText::stopPerf(std::unique_ptr<PerfCounters>& perf,
+                        PerfCounters::Counts& phase) {
+  if (!perf) {
+    return;
+  }
+  perf->stop();
+  PerfCounters::Counts counts = perf->read();
+  std::lock_guard<std::mutex> lock(perfMutex_);
+  phase.add(counts);
+}
+
+/*
+  printPerf: the counts of each phase (-perf), and per token of the input
+  for the dictionary and of the training for the training threads.
+*/
+void FastText::printPerf() const {
+  if (!perf_) {
+    return;
+  }
+  std::cout << "Hardware counters (user space):" << std::endl;
+  if (perfDict_.any()) {
+    perfDict_.print(std::cout, "  dictionary", trainTokens_);
+  }
+  perfTrain_.print(std::cout, "  training", *tokenCount_ - startTokens_);
+  perfSave_.print(std::cout, "  save", 0);
+}
+
+/*
+  scoreRecall: score the input vectors against the -neighbors sets. The
+  first time the recall reaches -targetRecall, the time is kept and the
+  training threads stop.
+*/
+void FastText::scoreRecall() {
+  recall_ = neighbors_->recall(*input_);
+  if (args_->targetRecall > 0 && recall_ >= args_->targetRecall &&
+      targetTime_ < 0) {
+    targetTime_ = elapsed();
+    stop_ = true;
+  }
+}
+
+/*
+  recallLoop: body of the thread that scores the recall every
+  -recallInterval seconds until the training threads finish.
+*/
+void FastText::recallLoop() {
+  std::unique_lock<std::mutex> lock(doneMutex_);
+  auto interval = std::chrono::duration<double>(args_->recallInterval);
+  while (!doneCv_.wait_for(lock, interval,
+                           [this]() { return trainingDone_; })) {
+    lock.unlock();
+    scoreRecall();
+    lock.lock();
+  }
+}
+
+/*
+  loadTest: parse the held-out file (-test) with the dictionary of the
+  model, without subsampling.
+*/
+std::shared_ptr<Corpus> FastText::loadTest() const {
+  std::ifstream ifs(args_->test);
+  if (!ifs.is_open()) {
+    std::cerr << "Test file cannot be opened!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  auto corpus = std::make_shared<Corpus>(dict_, false);
+  corpus->load(ifs);
+  if (corpus->size() == 0) {
+    std::cerr << "Test file has no patient of the dictionary." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  return corpus;
+}
+
+/*
+  evaluateEpoch: evaluate a snapshot of the parameters on the held-out file
+  after the given epoch. With -patience n, the training threads stop once
+  the loss has not improved for n epochs, unless it is the last one.
+*/
+void FastText::evaluateEpoch(int32_t epoch, bool last) {
+  evaluator_->snapshot(*input_, *output_, *attn_, *attnOffset_, *bias_);
+  real loss = evaluator_->evaluate();
+  testLoss_ = loss;
+  if (bestEpoch_ < 0 || loss < bestTestLoss_) {
+    bestTestLoss_ = loss;
+    bestEpoch_ = epoch;
+  } else if (!last && args_->patience > 0 &&
+             epoch - bestEpoch_ >= args_->patience) {
+    stoppedEpoch_ = epoch;
+    stop_ = true;
+  }
+  if (args_->verbose > 0) {
+    std::cout << (args_->verbose > 1 ? "\n" : "") << "Epoch " << epoch
+              << "  held-out loss: " << std::fixed << std::setprecision(6)
+              << loss << "  best: " << bestTestLoss_ << " (epoch "
+              << bestEpoch_ << ")" << std::endl;
+  }
+}
+
+/*
+  evalLoop: body of the thread that evaluates the held-out file at the end
+  of each epoch but the last one, which is evaluated after the training.
+*/
+void FastText::evalLoop() {
+  std::unique_lock<std::mutex> lock(doneMutex_);
+  int32_t epoch = *tokenCount_ / trainTokens_ + 1;
+  while (!doneCv_.wait_for(lock, std::chrono::milliseconds(100),
+                           [this]() { return trainingDone_; })) {
+    if (epoch < args_->epoch && *tokenCount_ >= epoch * trainTokens_) {
+      lock.unlock();
+      evaluateEpoch(epoch, false);
+      lock.lock();
+      epoch = std::max(epoch, int32_t(*tokenCount_ / trainTokens_)) + 1;
+    }
+  }
+}
+
+/*
+  eval: loss of the loaded model on a held-out file (eval command), with
+  the given number of threads.
+*/
+void FastText::eval(const std::string& filename, int32_t threads) {
+  if (args_->model != model_name::attn1 && args_->model != model_name::attn2) {
+    std::cerr << "Only attn1 and attn2 models can be evaluated." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  args_->test = filename;
+  if (args_->loss == loss_name::hs) {
+    tree_ =
+        std::make_shared<HuffmanTree>(dict_->getCounts(entry_type::word));
+  }
+  auto begin = std::chrono::steady_clock::now();
+  std::shared_ptr<Corpus> corpus = loadTest();
+  Evaluator evaluator(args_, dict_, corpus, tree_, *input_, *output_, *attn_,
+                      *attnOffset_, *bias_, threads);
+  real loss = evaluator.evaluate();
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - begin).count();
+  std::cout << "Patients: " << corpus->size() << std::endl;
+  std::cout << "Targets: " << evaluator.targets() << std::endl;
+  std::cout << "Loss: " << std::fixed << std::setprecision(6) << loss
+            << std::endl;
+  std::cout << "Time: " << std::setprecision(1) << seconds << "s"
+            << std::endl;
+}
+
+/*
+  printMemory: the memory that the training will take (-dryrun), by
+  component, for the dictionary built and the -dim, -attnws, -attnrank,
+  -thread and -loss options. The parameters are shared by the threads;
+  each thread has its own negative table and buffers.
+*/
+void FastText::printMemory() {
+  const int64_t nwords = dict_->nwords();
+  const int64_t npos = 2 * args_->attnws + 1;
+  const int32_t nthreads = threads();
+  int64_t total = 0;
+  std::cout << "Memory (dim " << args_->dim << ", attnws " << args_->attnws
+            << ", attnrank " << args_->attnrank << ", " << nthreads
+            << " threads, loss " << args_->lossName() << "):" << std::endl;
+  auto line = [&](const std::string& name, const std::string& shape,
+                  int64_t bytes) {
+    std::cout << "  " << std::left << std::setw(20) << name << std::setw(36)
+              << shape << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << bytes / 1048576.0 << " MB" << std::endl;
+    total += bytes;
+  };
+  auto shape = [](int64_t m, int64_t n) {
+    return std::to_string(m) + " x " + std::to_string(n);
+  };
+  line("dictionary", std::to_string(nwords) + " words", dict_->bytes());
+  line("input", shape(nwords, args_->dim), nwords * args_->dim * sizeof(real));
+  line("output", shape(nwords, args_->dim),
+       nwords * args_->dim * sizeof(real));
+  if (args_->attnrank > 0) {
+    line("attention",
+         shape(nwords, args_->attnrank) + " + " + shape(npos, args_->attnrank),
+         (nwords + npos) * args_->attnrank * sizeof(real));
+  } else {
+    line("attention", shape(nwords, npos), nwords * npos * sizeof(real));
+  }
+  if (args_->loss == loss_name::hs) {
+    tree_ =
+        std::make_shared<HuffmanTree>(dict_->getCounts(entry_type::word));
+    line("tree", std::to_string(2 * nwords - 1) + " nodes", tree_->bytes());
+  }
+  if (args_->checkpoint > 0) {
+    line("dirty rows", "3 x " + std::to_string(nwords), 3 * nwords);
+  }
+  if (args_->loss == loss_name::ns || args_->loss == loss_name::sampled) {
+    int64_t entries =
+        Model::negativeTableSize(dict_->getCounts(entry_type::word));
+    line("negative tables", std::to_string(nthreads) + " x " +
+                                std::to_string(entries) + " entries",
+         nthreads * entries * sizeof(int32_t));
+  }
+  // the scores of the output layer, and of the sampled softmax
+  int64_t buffers = nwords * sizeof(real);
+  if (args_->loss == loss_name::sampled) {
+    buffers += nwords * sizeof(real);
+  }
+  if (args_->deferInput > 0) {
+    buffers += nwords * sizeof(int32_t) +
+               int64_t(args_->deferInput) * args_->dim * sizeof(real);
+  }
+  if (args_->batch > 0) {
+    buffers += (2 * int64_t(args_->batch) * args_->dim +
+                2 * int64_t(args_->neg) * args_->dim) *
+               sizeof(real);
+  }
+  line("thread buffers", std::to_string(nthreads) + " x " +
+                             std::to_string(buffers / 1024) + " KB",
+       nthreads * buffers);
+  if (!args_->test.empty()) {
+    // a copy of the parameters, and the tables of the evaluation threads
+    int64_t params = 2 * nwords * args_->dim +
+                     (args_->attnrank > 0 ? (nwords + npos) * args_->attnrank
+                                          : nwords * npos);
+    int64_t tables =
+        args_->loss == loss_name::ns || args_->loss == loss_name::sampled
+            ? Model::negativeTableSize(dict_->getCounts(entry_type::word))
+            : 0;
+    line("held-out snapshot", std::to_string(nthreads) + " threads",
+         params * sizeof(real) +
+             nthreads * (tables * sizeof(int32_t) + buffers));
+  }
+  std::cout << "  " << std::left << std::setw(56) << "total" << std::right
+            << std::setw(10) << total / 1048576.0 << " MB" << std::endl;
+}
+
+/*
+  sampleTraining: train for -dryrunTime seconds with all the threads, and
+  estimate the time of the whole training from the words/sec. The sample
+  starts once every thread has built its tables and trained a few words,
+  and the time of this setup is added to the estimate. The sampled
+  parameters are not saved.
+*/
+void FastText::sampleTraining() {
+  if (!input_) {
+    initParameters();
+  }
+  loadFrozen();
+  start_ = std::chrono::steady_clock::now();
+  *tokenCount_ = 0;
+  startTokens_ = 0;
+  stop_ = false;
+  trainingDone_ = false;
+  real setup = 0.0, seconds = 0.0;
+  int64_t tokens = 0;
+  std::thread timer([&]() {
+    std::unique_lock<std::mutex> lock(doneMutex_);
+    auto started = [this]() {
+      for (int32_t i = 0; i < args_->thread; i++) {
+        if (threadTokens_[i] == 0) {
+          return trainingDone_;
+        }
+      }
+      return true;
+    };
+    while (!started()) {
+      doneCv_.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    setup = elapsed();
+    tokens = *tokenCount_;
+    auto interval = std::chrono::duration<double>(args_->dryrunTime);
+    doneCv_.wait_for(lock, interval, [this]() { return trainingDone_; });
+    stop_ = true;
+    seconds = elapsed() - setup;
+    tokens = *tokenCount_ - tokens;
+  });
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < args_->thread; i++) {
+    threads.push_back(std::thread([=]() { trainThread(i); }));
+  }
+  for (auto it = threads.begin(); it != threads.end(); ++it) {
+    it->join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(doneMutex_);
+    trainingDone_ = true;
+  }
+  doneCv_.notify_all();
+  timer.join();
+  double wps = seconds > 0 ? tokens / seconds : 0.0;
+  int64_t eta =
+      int64_t(setup) +
+      (wps > 0 ? int64_t(args_->epoch * trainTokens_ / wps) : 0);
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  std::cout << std::fixed << "Sample: " << tokens << " words in "
+            << std::setprecision(1) << seconds << "s after a setup of "
+            << setup << "s, " << std::setprecision(0)
+            << wps / threads.size() << " words/sec/thread, peak RSS "
+            << std::setprecision(1) << usage.ru_maxrss / 1024.0 << " MB"
+            << std::endl;
+  std::cout << "Estimated training time: " << eta / 3600 << "h"
+            << eta % 3600 / 60 << "m" << eta % 60 << "s (" << args_->epoch
+            << " epochs of " << trainTokens_ << " words)" << std::endl;
+}
+
+/*
+  dryRun: print the memory plan of the training (-dryrun), and sample it
+  with -dryrunTime.
+*/
+void FastText::dryRun() {
+  printMemory();
+  if (args_->dryrunTime > 0) {
+    sampleTraining();
+  }
+}
+
 void FastText::cbow(Model& model, real lr, const std::vector<int32_t>& line) {
   std::vector<int32_t> bow;
-  std::uniform_int_distribution<> uniform(1, args_->ws);
   for (int32_t w = 0; w < line.size(); w++) {
-    int32_t boundary = uniform(model.rng);
+    int32_t boundary = 1 + model.rng.bounded(args_->ws);
     bow.clear();
     for (int32_t c = -boundary; c <= boundary; c++) {
       if (c != 0 && w + c >= 0 && w + c < line.size()) {
@@ -195,14 +932,17 @@ int32_t FastText::get_attnid_day(int32_t dst) {
 }
 
 /*
-  attnContext: attention model from context view
+  attnContextT: attention model from context view, specialized on the view
+  and the loss, so that the inner loop does not branch on them, and on the
+  mini-batch engine (-batch > 0).
   Args:
     model: model instance,
     lr: learning rate,
     line: a vector of word_time data structure
 */
-void FastText::attnContext(Model& model, real lr,
-                           const std::vector<word_time>& line) {
+template <model_name M, loss_name L, bool Batch>
+void FastText::attnContextT(Model& model, real lr,
+                            const std::vector<word_time>& line) {
   // convert word_time to a vector of (word, time) pairs
   std::vector<std::pair<int32_t, int32_t>> seq;
   for (auto wt : line) {
@@ -210,12 +950,15 @@ void FastText::attnContext(Model& model, real lr,
       seq.push_back(std::make_pair(feature, wt.time));
     }
   }
-  // std::cout<< "seq.size(): " << seq.size() << std::endl;
-  std::uniform_int_distribution<> uniform(1, args_->ws);
+  if (args_->patientSeed) {
+    model.seekNegatives();
+  }
+  std::vector<std::pair<int32_t, int32_t>> input;
   for (int32_t f = 0; f < seq.size(); f++) {
-    int32_t boundary = uniform(model.rng);
-    // std::cout << "boundary: " << boundary << std::endl;
-    std::vector<std::pair<int32_t, int32_t>> input;
+    if (args_->shareNeg > 0 && (f == 0 || seq[f].second != seq[f - 1].second))
+      model.drawNegatives();
+    int32_t boundary = 1 + model.rng.bounded(args_->ws);
+    input.clear();
     for (int32_t c = -boundary; c <= boundary; c++) {
       if (c != 0 && f + c >= 0 && f + c < seq.size()) {
         int32_t distance = seq[f + c].second - seq[f].second + args_->attnws;
@@ -223,18 +966,59 @@ void FastText::attnContext(Model& model, real lr,
         input.push_back(std::make_pair(seq[f + c].first, distance));
       }
     }
-    // for (auto token : input) {
-    //    std::cout << dict_->getWord(token.first) << " " << token.second <<
-    //    std::endl;
-    //}
-    if (args_->model == model_name::attn1)
-      model.updateAttn(input, seq[f].first, lr);
-    else if (args_->model == model_name::attn2)
-      model.updateAttn2(input, seq[f].first, lr);
-    // if (f == 1) break;
+    if (Batch) {
+      model.updateAttnBatch(input, seq[f].first, lr);
+    } else {
+      model.updateAttnT<M, L>(input, seq[f].first, lr);
+    }
+  }
+  if (Batch) {
+    model.flushAttnBatch(lr);
+  }
+  model.flushInputGrad();
+}
+
+/*
+  idleContext: the models other than attn1 and attn2 are not trained on EMR
+  lines.
+*/
+void FastText::idleContext(Model&, real, const std::vector<word_time>&) {}
+
+/*
+  selectLoss: attnContextT of view M for the loss and -batch options. The
+  mini-batch engine only runs with -loss ns or sampled.
+*/
+template <model_name M>
+context_fn FastText::selectLoss() const {
+  const bool batch = args_->batch > 0;
+  switch (args_->loss) {
+    case loss_name::ns:
+      return batch ? &FastText::attnContextT<M, loss_name::ns, true>
+                   : &FastText::attnContextT<M, loss_name::ns, false>;
+    case loss_name::sampled:
+      return batch ? &FastText::attnContextT<M, loss_name::sampled, true>
+                   : &FastText::attnContextT<M, loss_name::sampled, false>;
+    case loss_name::hs:
+      return &FastText::attnContextT<M, loss_name::hs, false>;
+    default:
+      return &FastText::attnContextT<M, loss_name::softmax, false>;
   }
 }
 
+/*
+  selectContext: the training function of a thread, chosen once from the
+  model and loss options.
+*/
+context_fn FastText::selectContext() const {
+  if (args_->model == model_name::attn1) {
+    return selectLoss<model_name::attn1>();
+  }
+  if (args_->model == model_name::attn2) {
+    return selectLoss<model_name::attn2>();
+  }
+  return &FastText::idleContext;
+}
+
 void FastText::wordVectors() {
   std::string word;
   Vector vec(args_->dim);
@@ -247,38 +1031,300 @@ void FastText::wordVectors() {
 void FastText::printVectors() { wordVectors(); }
 
 void FastText::trainThread(int32_t threadId) {
-  std::ifstream ifs(args_->input);
-  // should seek to the beginning of the line
-  // utils::seek(ifs, threadId * utils::size(ifs) / args_->thread);
-  utils::seekToBOS(ifs, threadId * utils::size(ifs) / args_->thread);
+  PROFILE_THREAD(threadId);
+  std::ifstream ifs;
+  int64_t corpusLine = 0;
+  if (corpus_) {
+    corpusLine = threadId * corpus_->size() / args_->thread;
+  } else if (args_->nodes > 1) {
+    ifs.open(args_->input);
+    utils::seekToBOS(ifs, shardBegin_ + threadId *
+                                           (shardEnd_ - shardBegin_) /
+                                           threads());
+  } else if (resumed_ && threadPos_[threadId] >= 0) {
+    ifs.open(args_->input);
+    utils::seek(ifs, threadPos_[threadId]);
+  } else {
+    ifs.open(args_->input);
+    // should seek to the beginning of the line
+    // utils::seek(ifs, threadId * utils::size(ifs) / args_->thread);
+    utils::seekToBOS(ifs, threadId * utils::size(ifs) / threads());
+  }
 
-  Model model(input_, output_, attn_, bias_, args_, threadId);
+  Model model(input_, output_, attn_, attnOffset_, bias_, args_, threadId);
+  model.setTree(tree_);
   model.setTargetCounts(dict_->getCounts(entry_type::word));
+  model.setDirtyRows(dirtyInput_, dirtyOutput_, dirtyAttn_);
+  model.setFrozen(frozen_);
 
-  const int64_t ntokens = dict_->ntokens();
+  const int64_t ntokens = trainTokens_;
+  const context_fn context = selectContext();
   int64_t localTokenCount = 0;
   std::vector<word_time> line;
   std::vector<int32_t> labels;
-  while (tokenCount < args_->epoch * ntokens) {
-    real progress = real(tokenCount) / (args_->epoch * ntokens);
+  std::unique_ptr<PerfCounters> perf = startPerf();
+  int64_t threadTokens = threadTokens_[threadId];
+  int64_t parseNs = 0, computeNs = 0;
+  while (*tokenCount_ < args_->epoch * ntokens &&
+         !checkpoint::stopRequested() && !stop_) {
+    real progress = real(*tokenCount_) / (args_->epoch * ntokens);
     real lr = args_->lr * (1.0 - progress);
-    localTokenCount += dict_->getLineContext(ifs, line, labels, model.rng);
-    attnContext(model, lr, line);
+    auto parseStart = std::chrono::steady_clock::now();
+    if (args_->patientSeed) {
+      model.rng.setStream(*tokenCount_ / ntokens);
+    }
+    int32_t lineTokens;
+    {
+      PROFILE_SCOPE(parse);
+      if (corpus_) {
+        lineTokens = corpus_->getLine(corpusLine, line, model.rng);
+        corpusLine = (corpusLine + 1) % corpus_->size();
+      } else {
+        lineTokens = dict_->getLineContext(ifs, line, labels, model.rng);
+        if (args_->nodes > 1) {
+          int64_t pos = ifs.tellg();
+          if (pos < 0 || pos >= shardEnd_) {
+            utils::seek(ifs, shardBegin_);
+          }
+        }
+      }
+    }
+    localTokenCount += lineTokens;
+    threadTokens += lineTokens;
+    auto computeStart = std::chrono::steady_clock::now();
+    {
+      PROFILE_SCOPE(context);
+      (this->*context)(model, lr, line);
+    }
+    auto computeEnd = std::chrono::steady_clock::now();
+    parseNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   computeStart - parseStart).count();
+    computeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     computeEnd - computeStart).count();
+    if (args_->checkpoint > 0 || worker_ >= 0) {
+      // at the end of the file the next line starts at 0
+      int64_t pos = ifs.tellg();
+      threadTokens_[threadId] = threadTokens;
+      threadPos_[threadId] = pos < 0 ? 0 : pos;
+    }
+    if (localTokenCount > args_->lrUpdateRate) {
+      *tokenCount_ += localTokenCount;
+      localTokenCount = 0;
+      threadTokens_[threadId] = threadTokens;
+      threadParse_[threadId] = parseNs;
+      threadCompute_[threadId] = computeNs;
+      threadLoss_[threadId] = model.getLoss();
+      if (threadId == 0 && worker_ < 0) {
+        if (args_->verbose > 1) {
+          printInfo(progress);
+        }
+        writeMetrics(progress, false);
+      }
+    }
+  }
+  threadTokens_[threadId] = threadTokens;
+  threadParse_[threadId] = parseNs;
+  threadCompute_[threadId] = computeNs;
+  threadLoss_[threadId] = model.getLoss();
+  stopPerf(perf, perfTrain_);
+  if (threadId == 0 && worker_ < 0 && args_->verbose > 0) {
+    real progress = real(*tokenCount_) / (args_->epoch * ntokens);
+    printInfo(std::min(progress, real(1.0)));
+    std::cout << std::endl;
+  }
+  ifs.close();
+}
+
+/*
+  readPrefix: read the first -streamPrefix lines of stdin. They are queued
+  for training, and returned so that the vocabulary can be built from them.
+*/
+std::string FastText::readPrefix() {
+  stream_ = std::make_shared<LineQueue>();
+  std::string prefix, text;
+  while (stream_->lines.size() < size_t(args_->streamPrefix) &&
+         std::getline(std::cin, text)) {
+    prefix += text;
+    prefix += '\n';
+    stream_->lines.push_back(text);
+  }
+  return prefix;
+}
+
+/*
+  readStream: body of the reader thread, which queues the lines of stdin for
+  the training threads until stdin ends or the queue is stopped.
+*/
+void FastText::readStream(std::shared_ptr<LineQueue> queue) {
+  std::string text;
+  while (!checkpoint::stopRequested() && !queue->stop &&
+         std::getline(std::cin, text)) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    queue->notFull.wait(lock, [&queue]() {
+      return queue->lines.size() < LineQueue::MAX_LINES ||
+             checkpoint::stopRequested() || queue->stop;
+    });
+    queue->lines.push_back(std::move(text));
+    lock.unlock();
+    queue->notEmpty.notify_one();
+  }
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  queue->done = true;
+  queue->notEmpty.notify_all();
+}
+
+/*
+  popLine: take the next line of the stream; false once it is exhausted,
+  or when the training is stopped while waiting for one.
+*/
+bool FastText::popLine(std::string& text) {
+  std::unique_lock<std::mutex> lock(stream_->mutex);
+  while (stream_->lines.empty() && !stream_->done) {
+    // the reader may be blocked on stdin when the training is stopped
+    if (checkpoint::stopRequested() || stop_) {
+      return false;
+    }
+    stream_->notEmpty.wait_for(lock, std::chrono::milliseconds(100));
+  }
+  if (stream_->lines.empty()) {
+    return false;
+  }
+  text.swap(stream_->lines.front());
+  stream_->lines.pop_front();
+  lock.unlock();
+  stream_->notFull.notify_one();
+  return true;
+}
+
+/*
+  streamThread: trainThread for -input -. Every line taken from the queue
+  is parsed on its own, and trained on with a constant learning rate.
+*/
+void FastText::streamThread(int32_t threadId) {
+  PROFILE_THREAD(threadId);
+  Model model(input_, output_, attn_, attnOffset_, bias_, args_, threadId);
+  model.setTree(tree_);
+  model.setTargetCounts(dict_->getCounts(entry_type::word));
+  model.setDirtyRows(dirtyInput_, dirtyOutput_, dirtyAttn_);
+  model.setFrozen(frozen_);
+
+  const context_fn context = selectContext();
+  int64_t localTokenCount = 0;
+  std::string text;
+  std::vector<word_time> line;
+  std::vector<int32_t> labels;
+  std::unique_ptr<PerfCounters> perf = startPerf();
+  int64_t threadTokens = threadTokens_[threadId];
+  int64_t parseNs = 0, computeNs = 0;
+  while (!checkpoint::stopRequested() && !stop_ && popLine(text)) {
+    auto parseStart = std::chrono::steady_clock::now();
+    int32_t lineTokens;
+    {
+      PROFILE_SCOPE(parse);
+      text.push_back('\n');
+      std::istringstream in(text);
+      lineTokens = dict_->getLineContext(in, line, labels, model.rng);
+    }
+    localTokenCount += lineTokens;
+    threadTokens += lineTokens;
+    auto computeStart = std::chrono::steady_clock::now();
+    {
+      PROFILE_SCOPE(context);
+      (this->*context)(model, args_->lr, line);
+    }
+    auto computeEnd = std::chrono::steady_clock::now();
+    parseNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   computeStart - parseStart).count();
+    computeNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     computeEnd - computeStart).count();
+    if (args_->checkpoint > 0) {
+      threadTokens_[threadId] = threadTokens;
+    }
     if (localTokenCount > args_->lrUpdateRate) {
-      tokenCount += localTokenCount;
+      *tokenCount_ += localTokenCount;
       localTokenCount = 0;
-      if (threadId == 0 && args_->verbose > 1) {
-        printInfo(progress, model.getLoss());
-        // std::cout << "input l1 norm: " << input_->l1() << " ouput l1 norm "
-        //          << output_->l1() << std::endl;
+      threadTokens_[threadId] = threadTokens;
+      threadParse_[threadId] = parseNs;
+      threadCompute_[threadId] = computeNs;
+      threadLoss_[threadId] = model.getLoss();
+      if (threadId == 0) {
+        if (args_->verbose > 1) {
+          printInfo(0.0);
+        }
+        writeMetrics(0.0, false);
       }
     }
   }
+  *tokenCount_ += localTokenCount;
+  threadTokens_[threadId] = threadTokens;
+  threadParse_[threadId] = parseNs;
+  threadCompute_[threadId] = computeNs;
+  threadLoss_[threadId] = model.getLoss();
+  stopPerf(perf, perfTrain_);
   if (threadId == 0 && args_->verbose > 0) {
-    printInfo(1.0, model.getLoss());
+    printInfo(0.0);
     std::cout << std::endl;
   }
+}
+
+/*
+  sweep: train one model per configuration of -grid. The dictionary is
+  built and the input is parsed once into a Corpus; the configurations are
+  then trained one after the other, each with all the threads, on the
+  parsed patients in memory.
+*/
+void FastText::sweep(std::shared_ptr<Args> args) {
+  args_ = args;
+  dict_ = std::make_shared<Dictionary>(args_);
+  std::ifstream ifs(args_->input);
+  if (!ifs.is_open()) {
+    std::cerr << "Input file cannot be opened!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  dict_->readFromFile(ifs);
+  if (args_->reorder) {
+    ifs.clear();
+    ifs.seekg(std::streampos(0));
+    dict_->reorder(ifs);
+  }
+  ifs.clear();
+  ifs.seekg(std::streampos(0));
+  auto corpus = std::make_shared<Corpus>(dict_, args_->patientSeed);
+  corpus->load(ifs);
   ifs.close();
+  if (args_->verbose > 0) {
+    std::cout << "Parsed " << corpus->size() << " patients" << std::endl;
+  }
+
+  std::vector<Args> configs = args_->expandGrid();
+  std::vector<real> losses;
+  std::vector<double> seconds;
+  for (size_t i = 0; i < configs.size(); i++) {
+    if (args_->verbose > 0) {
+      std::cout << "Training " << configs[i].output << " (" << i + 1 << "/"
+                << configs.size() << ")" << std::endl;
+    }
+    auto begin = std::chrono::steady_clock::now();
+    FastText run;
+    run.args_ = std::make_shared<Args>(configs[i]);
+    run.dict_ = dict_;
+    run.corpus_ = corpus;
+    run.resetProgress();
+    run.initPerf();
+    run.trainTokens_ = dict_->ntokens();
+    run.initParameters();
+    run.startThreads();
+    losses.push_back(run.loss_);
+    seconds.push_back(std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - begin)
+                          .count());
+  }
+  std::cout << std::fixed;
+  for (size_t i = 0; i < configs.size(); i++) {
+    std::cout << configs[i].output << "  loss: " << std::setprecision(6)
+              << losses[i] << "  time: " << std::setprecision(1)
+              << seconds[i] << "s" << std::endl;
+  }
 }
 
 void FastText::loadVectors(std::string filename) {
@@ -322,22 +1368,75 @@ void FastText::loadVectors(std::string filename) {
   }
 }
 
-void FastText::train(std::shared_ptr<Args> args) {
-  args_ = args;
-  dict_ = std::make_shared<Dictionary>(args_);
-  if (args_->input == "-") {
-    // manage expectations
-    std::cerr << "Cannot use stdin for training!" << std::endl;
+/*
+  initFromModel: warm start from a previous model (-init). Its dictionary
+  and all its parameters are loaded, the concepts of the input that are not
+  in it are appended (see Dictionary::extend), and their rows are
+  initialized as in a new model. With -loss hs, the rows of output_ are
+  those of the inner nodes of the tree, which is rebuilt from the extended
+  counts, so they are all initialized as in a new model. Returns the number
+  of tokens of data, which is what an epoch trains on.
+*/
+int64_t FastText::initFromModel(const std::string& filename,
+                                std::istream& data) {
+  std::ifstream ifs(filename, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    std::cerr << "Model file cannot be opened for loading!" << std::endl;
     exit(EXIT_FAILURE);
   }
-  std::ifstream ifs(args_->input);
-  if (!ifs.is_open()) {
-    std::cerr << "Input file cannot be opened!" << std::endl;
+  Args saved;
+  saved.load(ifs);
+  if (saved.dim != args_->dim || saved.attnws != args_->attnws ||
+      saved.attnrank != args_->attnrank || saved.loss != args_->loss) {
+    std::cerr << "Model to initialize from does not match the -loss, -dim, "
+                 "-attnws or -attnrank options." << std::endl;
     exit(EXIT_FAILURE);
   }
-  dict_->readFromFile(ifs);
+  dict_->load(ifs);
+  Matrix input, output, attn, attnOffset;
+  Vector bias(2 * args_->attnws + 1);
+  input.load(ifs);
+  output.load(ifs);
+  attn.load(ifs);
+  if (args_->attnrank > 0) {
+    attnOffset.load(ifs);
+  }
+  bias.load(ifs);
   ifs.close();
 
+  int64_t nold = dict_->nwords();
+  int64_t ntokens = dict_->extend(data);
+  initWords_ = nold;
+
+  int64_t nwords = dict_->nwords();
+  input_ = std::make_shared<Matrix>(nwords, args_->dim);
+  input_->uniform(1.0 / args_->dim);
+  std::copy(input.data_, input.data_ + nold * input.n_, input_->data_);
+  output_ = std::make_shared<Matrix>(nwords, args_->dim);
+  output_->zero();
+  if (args_->loss != loss_name::hs) {
+    std::copy(output.data_, output.data_ + nold * output.n_, output_->data_);
+  }
+  if (args_->attnrank > 0) {
+    attn_ = std::make_shared<Matrix>(nwords, args_->attnrank);
+    attn_->uniform(1.0 / args_->attnrank);
+    attnOffset_ = std::make_shared<Matrix>(attnOffset);
+  } else {
+    attn_ = std::make_shared<Matrix>(nwords, 2 * args_->attnws + 1);
+    attn_->zero();
+    attnOffset_ = std::make_shared<Matrix>();
+  }
+  std::copy(attn.data_, attn.data_ + nold * attn.n_, attn_->data_);
+  bias_ = std::make_shared<Vector>(2 * args_->attnws + 1);
+  std::copy(bias.data_, bias.data_ + bias.m_, bias_->data_);
+  return ntokens;
+}
+
+/*
+  initParameters: initialize the parameters of a new model for the words
+  of dict_.
+*/
+void FastText::initParameters() {
   if (args_->pretrainedVectors.size() != 0) {
     loadVectors(args_->pretrainedVectors);
   } else {
@@ -358,26 +1457,516 @@ void FastText::train(std::shared_ptr<Args> args) {
   }
   */
   // ws = args_->ws;
-  attn_ = std::make_shared<Matrix>(dict_->nwords(), 2 * args_->attnws + 1);
-  attn_->zero();
+  if (args_->attnrank > 0) {
+    // low-rank attention: scores are attn_ (nwords x rank) times the
+    // transpose of attnOffset_ ((2 * attnws + 1) x rank)
+    attn_ = std::make_shared<Matrix>(dict_->nwords(), args_->attnrank);
+    attn_->uniform(1.0 / args_->attnrank);
+    attnOffset_ =
+        std::make_shared<Matrix>(2 * args_->attnws + 1, args_->attnrank);
+    attnOffset_->zero();
+  } else {
+    attn_ = std::make_shared<Matrix>(dict_->nwords(), 2 * args_->attnws + 1);
+    attn_->zero();
+    attnOffset_ = std::make_shared<Matrix>();
+  }
   bias_ = std::make_shared<Vector>(2 * args_->attnws + 1);
   // std::cout << "attention size: " << 2 * args_->attnws + 1 << std::endl;
   bias_->zero();
+}
 
-  start = clock();
-  tokenCount = 0;
-  std::vector<std::thread> threads;
+/*
+  loadFrozen: build the mask of the rows kept fixed: the words of the -init
+  model with -freeze init, and the concepts of -freezeList. Concepts of the
+  list that are not in the dictionary are ignored.
+*/
+void FastText::loadFrozen() {
+  if (!args_->freezeInit && args_->freezeList.empty()) return;
+  int32_t nwords = dict_->nwords();
+  frozen_ = std::make_shared<std::vector<uint8_t>>(nwords, 0);
+  if (args_->freezeInit) {
+    std::fill(frozen_->begin(), frozen_->begin() + initWords_, 1);
+  }
+  if (!args_->freezeList.empty()) {
+    std::ifstream ifs(args_->freezeList);
+    if (!ifs.is_open()) {
+      std::cerr << "Freeze list cannot be opened!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::string word;
+    while (ifs >> word) {
+      int32_t id = dict_->getId(word);
+      if (id >= 0 && id < nwords) {
+        (*frozen_)[id] = 1;
+      }
+    }
+  }
+  if (args_->verbose > 0) {
+    int64_t nfrozen = std::count(frozen_->begin(), frozen_->end(), 1);
+    std::cout << "Frozen rows: " << nfrozen << " of " << nwords << std::endl;
+  }
+}
+
+/*
+  resetProgress: allocate the progress of the training (tokens trained,
+  and the file position, tokens, times and loss of each thread) and set it
+  to 0.
+*/
+void FastText::resetProgress() {
+  int32_t nthreads = threads();
+  progress_.reset(new std::atomic<int64_t>[4 * nthreads + 1]);
+  losses_.reset(new std::atomic<real>[nthreads]);
+  tokenCount_ = progress_.get();
+  threadPos_ = tokenCount_ + 1;
+  threadTokens_ = threadPos_ + nthreads;
+  threadParse_ = threadTokens_ + nthreads;
+  threadCompute_ = threadParse_ + nthreads;
+  threadLoss_ = losses_.get();
+  *tokenCount_ = 0;
+  for (int32_t i = 0; i < nthreads; i++) {
+    threadPos_[i] = 0;
+    threadTokens_[i] = 0;
+    threadParse_[i] = 0;
+    threadCompute_[i] = 0;
+    threadLoss_[i] = 0.0;
+  }
+  resumed_ = false;
+  ckptGeneration_ = 0;
+  initWords_ = 0;
+  worker_ = -1;
+}
+
+/*
+  threads: number of training threads, over all the processes.
+*/
+int32_t FastText::threads() const {
+  return args_->thread * std::max(args_->workers, 1);
+}
+
+/*
+  shareMatrix: copy a matrix to the shared segment, and return a view of
+  the copy.
+*/
+std::shared_ptr<Matrix> FastText::shareMatrix(const Matrix& mat) {
+  int64_t size = mat.m_ * mat.n_;
+  real* data = (real*)segment_->take(size * sizeof(real));
+  std::copy(mat.data_, mat.data_ + size, data);
+  return std::make_shared<Matrix>(mat.m_, mat.n_, data);
+}
+
+/*
+  shareParameters: move the parameters and the progress of the training to
+  a shared memory segment, which the worker processes inherit (-workers).
+*/
+void FastText::shareParameters() {
+  int32_t nthreads = threads();
+  size_t progressBytes = sizeof(std::atomic<int64_t>) * (4 * nthreads + 1);
+  size_t lossBytes = sizeof(std::atomic<real>) * nthreads;
+  size_t bytes = SharedSegment::aligned(progressBytes) +
+                 SharedSegment::aligned(lossBytes);
+  for (auto mat : {input_, output_, attn_, attnOffset_}) {
+    bytes += SharedSegment::aligned(mat->m_ * mat->n_ * sizeof(real));
+  }
+  bytes += SharedSegment::aligned(bias_->m_ * sizeof(real));
+  segment_ = std::make_shared<SharedSegment>(
+      "/mce." + std::to_string(getpid()), bytes);
+
+  auto progress = (std::atomic<int64_t>*)segment_->take(progressBytes);
+  for (int32_t i = 0; i < 4 * nthreads + 1; i++) {
+    new (progress + i) std::atomic<int64_t>(progress_[i].load());
+  }
+  tokenCount_ = progress;
+  threadPos_ = tokenCount_ + 1;
+  threadTokens_ = threadPos_ + nthreads;
+  threadParse_ = threadTokens_ + nthreads;
+  threadCompute_ = threadParse_ + nthreads;
+  for (int32_t i = 0; i < nthreads; i++) {
+    // no line trained yet: a restarted thread starts on its own shard
+    threadPos_[i] = -1;
+  }
+  threadLoss_ = (std::atomic<real>*)segment_->take(lossBytes);
+  for (int32_t i = 0; i < nthreads; i++) {
+    new (threadLoss_ + i) std::atomic<real>(losses_[i].load());
+  }
+  input_ = shareMatrix(*input_);
+  output_ = shareMatrix(*output_);
+  attn_ = shareMatrix(*attn_);
+  attnOffset_ = shareMatrix(*attnOffset_);
+  real* bias = (real*)segment_->take(bias_->m_ * sizeof(real));
+  std::copy(bias_->data_, bias_->data_ + bias_->m_, bias);
+  bias_ = std::make_shared<Vector>(bias_->m_, bias);
+}
+
+/*
+  unshareParameters: copy the parameters and the progress back to the
+  process, and release the shared segment.
+*/
+void FastText::unshareParameters() {
+  int32_t nthreads = threads();
+  for (int32_t i = 0; i < 4 * nthreads + 1; i++) {
+    progress_[i] = tokenCount_[i].load();
+  }
+  for (int32_t i = 0; i < nthreads; i++) {
+    losses_[i] = threadLoss_[i].load();
+  }
+  tokenCount_ = progress_.get();
+  threadPos_ = tokenCount_ + 1;
+  threadTokens_ = threadPos_ + nthreads;
+  threadParse_ = threadTokens_ + nthreads;
+  threadCompute_ = threadParse_ + nthreads;
+  threadLoss_ = losses_.get();
+  input_ = std::make_shared<Matrix>(*input_);
+  output_ = std::make_shared<Matrix>(*output_);
+  attn_ = std::make_shared<Matrix>(*attn_);
+  attnOffset_ = std::make_shared<Matrix>(*attnOffset_);
+  auto bias = std::make_shared<Vector>(bias_->m_);
+  std::copy(bias_->data_, bias_->data_ + bias_->m_, bias->data_);
+  bias_ = bias;
+  segment_.reset();
+}
+
+/*
+  forkWorker: start the process of a worker, which trains -thread threads
+  (ids worker * thread to (worker + 1) * thread - 1) on the shared
+  parameters and exits. With resumed, the threads continue after the last
+  line they trained, recorded in the shared progress, or from the start of
+  their shard if they had not trained any.
+*/
+pid_t FastText::forkWorker(int32_t worker, bool resumed) {
+  std::cout << std::flush;
+  pid_t pid = fork();
+  if (pid < 0) {
+    std::cerr << "Worker cannot be started: " << strerror(errno) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (pid > 0) {
+    return pid;
+  }
+  // do not outlive the coordinator
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  worker_ = worker;
+  resumed_ = resumed;
+  std::vector<std::thread> workers;
   for (int32_t i = 0; i < args_->thread; i++) {
-    threads.push_back(std::thread([=]() { trainThread(i); }));
+    int32_t threadId = worker * args_->thread + i;
+    workers.push_back(std::thread([=]() { trainThread(threadId); }));
+  }
+  for (auto it = workers.begin(); it != workers.end(); ++it) {
+    it->join();
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+/*
+  trainWorkers: train with -workers processes over shared parameters. The
+  coordinator (this process) builds the dictionary and the parameters,
+  forks the workers, reports the progress and saves the model. Each thread
+  of the workers starts on its own shard of the input, as the threads of a
+  single process do. A worker that fails before the end is forked again;
+  the updates it made are kept and its threads continue from their last
+  line.
+*/
+void FastText::trainWorkers() {
+  shareParameters();
+  const int64_t total = args_->epoch * trainTokens_;
+  std::vector<pid_t> pids(args_->workers);
+  std::vector<int32_t> restarts(args_->workers, 0);
+  for (int32_t w = 0; w < args_->workers; w++) {
+    pids[w] = forkWorker(w, false);
+  }
+  int32_t running = args_->workers;
+  while (running > 0) {
+    int status;
+    pid_t pid = waitpid(-1, &status, WNOHANG);
+    if (pid == 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      real progress = std::min(real(*tokenCount_) / total, real(1.0));
+      if (args_->verbose > 1) {
+        printInfo(progress);
+      }
+      writeMetrics(progress, false);
+      continue;
+    }
+    if (pid < 0) {
+      break;
+    }
+    int32_t w = std::find(pids.begin(), pids.end(), pid) - pids.begin();
+    if (w == args_->workers) {
+      continue;
+    }
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    if (ok || *tokenCount_ >= total) {
+      pids[w] = -1;
+      running--;
+      continue;
+    }
+    if (++restarts[w] > MAX_WORKER_RESTARTS) {
+      std::cerr << "\nWorker " << w << " failed " << restarts[w]
+                << " times, stopping." << std::endl;
+      for (auto p : pids) {
+        if (p > 0) kill(p, SIGKILL);
+      }
+      exit(EXIT_FAILURE);
+    }
+    std::cerr << "\nWorker " << w << " failed, restarting it." << std::endl;
+    pids[w] = forkWorker(w, true);
+  }
+  if (args_->verbose > 0) {
+    printInfo(std::min(real(*tokenCount_) / total, real(1.0)));
+    std::cout << std::endl;
+  }
+  unshareParameters();
+}
+
+void FastText::train(std::shared_ptr<Args> args) {
+  args_ = args;
+  dict_ = std::make_shared<Dictionary>(args_);
+  resetProgress();
+  initPerf();
+  if (args_->resume.size() != 0) {
+    loadCheckpoint(args_->resume);
+  } else {
+    std::ifstream ifs;
+    std::istringstream prefix;
+    std::istream* data = &ifs;
+    if (args_->input == "-") {
+      prefix.str(readPrefix());
+      data = &prefix;
+    } else {
+      ifs.open(args_->input);
+      if (!ifs.is_open()) {
+        std::cerr << "Input file cannot be opened!" << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+    std::unique_ptr<PerfCounters> perf = startPerf();
+    if (args_->init.size() != 0) {
+      trainTokens_ = initFromModel(args_->init, *data);
+      stopPerf(perf, perfDict_);
+      if (args_->dryrun) {
+        dryRun();
+        return;
+      }
+    } else {
+      dict_->readFromFile(*data);
+      trainTokens_ = dict_->ntokens();
+      if (args_->reorder) {
+        data->clear();
+        data->seekg(std::streampos(0));
+        dict_->reorder(*data);
+      }
+      stopPerf(perf, perfDict_);
+      if (args_->dryrun) {
+        dryRun();
+        return;
+      }
+      initParameters();
+    }
+  }
+  if (args_->nodes > 1) {
+    setShard();
+  }
+
+  startThreads();
+}
+
+/*
+  startThreads: train on the data set up by train or sweep, and save the
+  model.
+*/
+void FastText::startThreads() {
+  loadFrozen();
+
+  if (args_->loss == loss_name::hs) {
+    // built once and shared by the models of all threads
+    tree_ =
+        std::make_shared<HuffmanTree>(dict_->getCounts(entry_type::word));
+  }
+
+  start_ = std::chrono::steady_clock::now();
+  *tokenCount_ = 0;
+  for (int32_t i = 0; i < threads(); i++) {
+    *tokenCount_ += threadTokens_[i];
+  }
+  startTokens_ = *tokenCount_;
+  recall_ = 0.0;
+  stop_ = false;
+  targetTime_ = -1.0;
+  if (!args_->neighbors.empty()) {
+    neighbors_ = std::make_shared<Neighbors>(dict_, args_->neighbors);
+  }
+  testLoss_ = 0.0;
+  bestEpoch_ = -1;
+  stoppedEpoch_ = -1;
+  if (!args_->test.empty()) {
+    evaluator_ = std::make_shared<Evaluator>(
+        args_, dict_, loadTest(), tree_, *input_, *output_, *attn_,
+        *attnOffset_, *bias_, args_->thread);
+  }
+  openMetrics();
+  const real total = args_->epoch * trainTokens_;
+  if (args_->workers > 0) {
+    trainWorkers();
+    loss_ = meanLoss();
+    writeMetrics(std::min(real(*tokenCount_) / total, real(1.0)), true);
+    model_ = std::make_shared<Model>(input_, output_, attn_, attnOffset_,
+                                     bias_, args_, 0);
+    saveModel();
+    if (args_->model != model_name::sup) {
+      saveVectors();
+    }
+    return;
+  }
+  std::thread writer;
+  if (args_->checkpoint > 0) {
+    dirtyInput_ = std::make_shared<DirtyRows>(input_->m_);
+    dirtyOutput_ = std::make_shared<DirtyRows>(output_->m_);
+    dirtyAttn_ = std::make_shared<DirtyRows>(attn_->m_);
+    ckptBaseBytes_ = 0;
+    ckptLogBytes_ = 0;
+    trainingDone_ = false;
+    checkpoint::installSignalHandler();
+    writer = std::thread([this]() { checkpointLoop(); });
+  }
+  if (args_->nodes > 1) {
+    startSync();
+    trainingDone_ = false;
+    writer = std::thread([this]() { syncLoop(); });
+  }
+  std::thread scorer;
+  if (neighbors_) {
+    trainingDone_ = false;
+    scorer = std::thread([this]() { recallLoop(); });
+  }
+  std::thread evaluator;
+  if (evaluator_) {
+    trainingDone_ = false;
+    evaluator = std::thread([this]() { evalLoop(); });
+  }
+  profile::reset(!args_->trace.empty());
+  std::vector<std::thread> threads;
+  std::thread reader;
+  if (args_->input == "-") {
+    if (!stream_) {
+      stream_ = std::make_shared<LineQueue>();
+    }
+    reader = std::thread(readStream, stream_);
+    for (int32_t i = 0; i < args_->thread; i++) {
+      threads.push_back(std::thread([=]() { streamThread(i); }));
+    }
+  } else {
+    for (int32_t i = 0; i < args_->thread; i++) {
+      threads.push_back(std::thread([=]() { trainThread(i); }));
+    }
   }
   for (auto it = threads.begin(); it != threads.end(); ++it) {
     it->join();
   }
-  model_ = std::make_shared<Model>(input_, output_, attn_, bias_, args_, 0);
+  loss_ = meanLoss();
+  if (neighbors_) {
+    scoreRecall();
+  }
+  if (evaluator_) {
+    {
+      std::lock_guard<std::mutex> lock(doneMutex_);
+      trainingDone_ = true;
+    }
+    doneCv_.notify_all();
+    evaluator.join();
+    if (stoppedEpoch_ < 0) {
+      // the epochs trained, when stopped by -targetRecall or SIGTERM
+      int64_t epochs = (*tokenCount_ + trainTokens_ / 2) / trainTokens_;
+      evaluateEpoch(std::max(std::min(epochs, int64_t(args_->epoch)),
+                             int64_t(1)),
+                    true);
+    } else if (args_->verbose > 0) {
+      std::cout << "Early stopping after epoch " << stoppedEpoch_
+                << ": no improvement since epoch " << bestEpoch_ << std::endl;
+    }
+  }
+  writeMetrics(args_->input == "-"
+                   ? 0.0
+                   : std::min(real(*tokenCount_) / total, real(1.0)),
+               true);
+#ifdef MCE_PROFILE
+  if (args_->verbose > 0) {
+    profile::printSummary(std::cout);
+  }
+  if (!args_->trace.empty()) {
+    profile::saveTrace(args_->trace);
+  }
+#endif
+  if (reader.joinable()) {
+    if (checkpoint::stopRequested() || stop_) {
+      // may be blocked reading stdin; it only touches stream_, which it
+      // keeps alive
+      {
+        std::lock_guard<std::mutex> lock(stream_->mutex);
+        stream_->stop = true;
+      }
+      stream_->notFull.notify_all();
+      reader.detach();
+    } else {
+      reader.join();
+    }
+  }
+  if (writer.joinable() || scorer.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(doneMutex_);
+      trainingDone_ = true;
+    }
+    doneCv_.notify_all();
+    if (writer.joinable()) {
+      writer.join();
+    }
+    if (scorer.joinable()) {
+      scorer.join();
+    }
+  }
+  if (neighbors_ && args_->verbose > 0) {
+    std::cout << "Recall: " << std::setprecision(4) << recall_ << " ("
+              << neighbors_->queries() << " concepts)";
+    if (args_->targetRecall > 0) {
+      std::cout << "  target " << args_->targetRecall;
+      if (targetTime_ >= 0) {
+        std::cout << " reached in " << std::setprecision(1) << targetTime_
+                  << "s";
+      } else {
+        std::cout << " not reached";
+      }
+    }
+    std::cout << std::endl;
+  }
+  if (args_->checkpoint > 0) {
+    if (checkpoint::stopRequested()) {
+      // the threads are stopped, so this checkpoint is exact
+      saveCheckpoint();
+      std::cout << "Stopped, checkpoint saved to " << args_->output << ".ckpt"
+                << std::endl;
+      return;
+    }
+  }
+  if (args_->nodes > 1) {
+    if (args_->verbose > 0) {
+      std::cout << "Sync: " << sync_->rounds() << " rounds, "
+                << sync_->bytes() / 1e6 << "MB sent" << std::endl;
+    }
+    sync_.reset();
+    if (args_->rank != 0) {
+      // the nodes end with the same parameters, rank 0 saves them
+      printPerf();
+      return;
+    }
+  }
+  model_ = std::make_shared<Model>(input_, output_, attn_, attnOffset_, bias_,
+                                   args_, 0);
 
+  std::unique_ptr<PerfCounters> perf = startPerf();
   saveModel();
   if (args_->model != model_name::sup) {
     saveVectors();
   }
+  stopPerf(perf, perfSave_);
+  printPerf();
 }
 }  // namespace fasttext
@@ -12,19 +12,58 @@
 
 #include <time.h>
 
+#include <sys/types.h>
+
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
 #include <memory>
+#include <mutex>
+#include <string>
 
 #include "args.h"
+#include "checkpoint.h"
+#include "corpus.h"
 #include "dictionary.h"
+#include "distributed.h"
+#include "evaluator.h"
 #include "matrix.h"
 #include "model.h"
+#include "neighbors.h"
+#include "perf.h"
+#include "profile.h"
+#include "shm.h"
 #include "real.h"
 #include "utils.h"
 #include "vector.h"
 
 namespace fasttext {
 
+/*
+  LineQueue: lines of stdin (-input -) queued by the reader thread for the
+  training threads, at most MAX_LINES on top of the prefix. The reader
+  thread only uses the queue, which it shares, so that it can be left
+  blocked on stdin when the training stops early.
+*/
+struct LineQueue {
+  static const size_t MAX_LINES = 4096;
+
+  std::deque<std::string> lines;
+  bool done;
+  std::atomic<bool> stop;
+  std::mutex mutex;
+  std::condition_variable notEmpty;
+  std::condition_variable notFull;
+
+  LineQueue() : done(false), stop(false) {}
+};
+
+class FastText;
+typedef void (FastText::*context_fn)(Model&, real,
+                                     const std::vector<word_time>&);
+
 class FastText {
  private:
   std::shared_ptr<Args> args_;
@@ -32,11 +71,108 @@ class FastText {
   std::shared_ptr<Matrix> input_;
   std::shared_ptr<Matrix> output_;
   std::shared_ptr<Matrix> attn_;
+  std::shared_ptr<Matrix> attnOffset_;
   std::shared_ptr<Vector> bias_;
   std::shared_ptr<Model> model_;
-  std::atomic<int64_t> tokenCount;
-  clock_t start;
+  std::shared_ptr<const HuffmanTree> tree_;
+  // tokens trained, and the file position, tokens, parsing and compute
+  // time (ns) and loss of each thread; in progress_ and losses_, or in the
+  // shared segment with -workers
+  std::unique_ptr<std::atomic<int64_t>[]> progress_;
+  std::unique_ptr<std::atomic<real>[]> losses_;
+  std::atomic<int64_t>* tokenCount_;
+  std::atomic<int64_t>* threadPos_;
+  std::atomic<int64_t>* threadTokens_;
+  std::atomic<int64_t>* threadParse_;
+  std::atomic<int64_t>* threadCompute_;
+  std::atomic<real>* threadLoss_;
+  int64_t startTokens_;
+  // tokens of an epoch (only the new data with -init)
+  int64_t trainTokens_;
+  // words of the -init model, and the rows kept fixed (-freeze, -freezeList)
+  int64_t initWords_;
+  std::shared_ptr<std::vector<uint8_t>> frozen_;
+  // parsed input shared by the models of a sweep, null otherwise
+  std::shared_ptr<const Corpus> corpus_;
+  // loss of the threads at the end of the training
+  real loss_;
+  // used for multi-process training (-workers):
+  static const int32_t MAX_WORKER_RESTARTS = 3;
+  std::shared_ptr<SharedSegment> segment_;
+  int32_t worker_;
+  // used for multi-node training (-nodes):
+  std::shared_ptr<ParameterSync> sync_;
+  std::shared_ptr<Matrix> bias2d_;
+  int64_t shardBegin_;
+  int64_t shardEnd_;
+  std::chrono::steady_clock::time_point start_;
+  // used for the metrics of the training (-metrics):
+  std::ofstream metrics_;
+  std::chrono::steady_clock::time_point lastMetrics_;
+  // used for the hardware counters (-perf):
+  bool perf_;
+  PerfCounters::Counts perfDict_;
+  PerfCounters::Counts perfTrain_;
+  PerfCounters::Counts perfSave_;
+  std::mutex perfMutex_;
+  // used for the recall of the planted neighbors (-neighbors):
+  std::shared_ptr<Neighbors> neighbors_;
+  std::atomic<real> recall_;
+  real targetTime_;
+  // used for the held-out evaluation (-test):
+  std::shared_ptr<Evaluator> evaluator_;
+  std::atomic<real> testLoss_;
+  real bestTestLoss_;
+  int32_t bestEpoch_;
+  int32_t stoppedEpoch_;
   int32_t ws;
+  // used for checkpoints (-checkpoint, -resume):
+  std::shared_ptr<DirtyRows> dirtyInput_;
+  std::shared_ptr<DirtyRows> dirtyOutput_;
+  std::shared_ptr<DirtyRows> dirtyAttn_;
+  bool resumed_;
+  int64_t ckptGeneration_;
+  int64_t ckptBaseBytes_;
+  int64_t ckptLogBytes_;
+  bool trainingDone_;
+  // set to stop the training threads early (-targetRecall, -dryrunTime)
+  std::atomic<bool> stop_;
+  std::mutex doneMutex_;
+  std::condition_variable doneCv_;
+
+  // used for streaming from stdin (-input -)
+  std::shared_ptr<LineQueue> stream_;
+
+  void saveProgress(std::ostream&);
+  void loadProgress(std::istream&);
+  void checkpointLoop();
+  void resetProgress();
+  void startThreads();
+  int32_t threads() const;
+  std::shared_ptr<Matrix> shareMatrix(const Matrix&);
+  void shareParameters();
+  void unshareParameters();
+  pid_t forkWorker(int32_t, bool);
+  void trainWorkers();
+  void setShard();
+  void startSync();
+  void syncLoop();
+  real elapsed() const;
+  real meanLoss() const;
+  void openMetrics();
+  void writeMetrics(real, bool);
+  void initPerf();
+  std::unique_ptr<PerfCounters> startPerf() const;
+  void stopPerf(std::unique_ptr<PerfCounters>&, PerfCounters::Counts&);
+  void printPerf() const;
+  void scoreRecall();
+  void recallLoop();
+  std::shared_ptr<Corpus> loadTest() const;
+  void evaluateEpoch(int32_t, bool);
+  void evalLoop();
+  void printMemory();
+  void sampleTraining();
+  void dryRun();
 
  public:
   void getVector(Vector&, const std::string&);
@@ -45,15 +181,32 @@ class FastText {
   void saveModel();
   void loadModel(const std::string&);
   void loadModel(std::istream&);
-  void printInfo(real, real);
+  void saveCheckpoint();
+  void loadCheckpoint(const std::string&);
+  int64_t initFromModel(const std::string&, std::istream&);
+  void initParameters();
+  void loadFrozen();
+  std::string readPrefix();
+  static void readStream(std::shared_ptr<LineQueue>);
+  bool popLine(std::string&);
+  void printInfo(real);
+  // last recall of -neighbors, and seconds to -targetRecall (-1 if missed)
+  real recall() const { return recall_; }
+  real targetTime() const { return targetTime_; }
 
   void supervised(Model&, real, const std::vector<int32_t>&,
                   const std::vector<int32_t>&);
   void cbow(Model&, real, const std::vector<int32_t>&);
   void skipgram(Model&, real, const std::vector<int32_t>&);
   // void sgContext(Model&, real, const std::vector<word_time>&);
-  void attnContext(Model&, real, const std::vector<word_time>&);
+  template <model_name, loss_name, bool>
+  void attnContextT(Model&, real, const std::vector<word_time>&);
+  void idleContext(Model&, real, const std::vector<word_time>&);
+  template <model_name>
+  context_fn selectLoss() const;
+  context_fn selectContext() const;
   void test(std::istream&, int32_t);
+  void eval(const std::string&, int32_t);
   void predict(std::istream&, int32_t, bool);
   void predict(std::istream&, int32_t,
                std::vector<std::pair<real, std::string>>&) const;
@@ -61,7 +214,9 @@ class FastText {
   void textVectors();
   void printVectors();
   void trainThread(int32_t);
+  void streamThread(int32_t);
   void train(std::shared_ptr<Args>);
+  void sweep(std::shared_ptr<Args>);
 
   void loadVectors(std::string);
   int32_t get_attnid_week(int32_t);
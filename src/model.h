@@ -17,32 +17,30 @@
 #include <vector>
 
 #include "args.h"
+#include "checkpoint.h"
+#include "kernels.h"
 #include "matrix.h"
 #include "real.h"
+#include "rng.h"
+#include "tree.h"
 #include "vector.h"
 
 #define SIGMOID_TABLE_SIZE 512
 #define MAX_SIGMOID 8
 #define LOG_TABLE_SIZE 512
+#define SOFTMAX_LANES 8
 
 namespace fasttext {
 
 // class Vector;
 
-struct Node {
-  int32_t parent;
-  int32_t left;
-  int32_t right;
-  int64_t count;
-  bool binary;
-};
-
 class Model {
  private:
   std::shared_ptr<Matrix> wi_;
   std::shared_ptr<Matrix> wo_;
   std::shared_ptr<Args> args_;
   std::shared_ptr<Matrix> attn_;
+  std::shared_ptr<Matrix> attnOffset_;
   std::shared_ptr<Vector> bias_;
   std::vector<real> softmaxattn_;
   Vector hidden_;
@@ -52,22 +50,75 @@ class Model {
   int32_t isz_;
   int32_t osz_;
   int32_t grad_th_;
+  int32_t attnrank_;
   real loss_;
   int64_t nexamples_;
+  kernels::RowKernels kernels_;
   real* t_sigmoid;
   real* t_log;
   // used for negative sampling:
   std::vector<int32_t> negatives;
   size_t negpos;
+  std::vector<int32_t> sharedNegatives_;
+  // scores of the target and of the shared negatives
+  std::vector<real> sharedScores_;
+  // used for sampled softmax:
+  std::vector<real> logq_;
+  std::vector<int32_t> samples_;
+  // logits of the samples, neg + 1 of them (output_ has nwords entries)
+  std::vector<real> sampleScores_;
+  // used by the mini-batch engine:
+  std::vector<std::vector<std::pair<int32_t, int32_t>>> batchInputs_;
+  std::vector<std::vector<real>> batchAttn_;
+  std::vector<int32_t> batchTargets_;
+  std::vector<int32_t> batchNegatives_;
+  std::vector<real> batchHidden_;
+  std::vector<real> batchGrad_;
+  std::vector<real> posAlpha_;
+  std::vector<real> negAlpha_;
+  std::vector<real> negRows_;
+  std::vector<real> negGrad_;
+  int32_t nbatch_;
+  // used for deferred input gradients:
+  std::vector<int32_t> deferSlot_;
+  std::vector<int32_t> deferRows_;
+  std::vector<real> deferGrad_;
+  int32_t ndefer_;
   // used for hierarchical softmax:
-  std::vector<std::vector<int32_t>> paths;
-  std::vector<std::vector<bool>> codes;
-  std::vector<Node> tree;
+  std::shared_ptr<const HuffmanTree> tree_;
+  // rows written since the last checkpoint (-checkpoint), may be null:
+  std::shared_ptr<DirtyRows> dirtyInput_;
+  std::shared_ptr<DirtyRows> dirtyOutput_;
+  std::shared_ptr<DirtyRows> dirtyAttn_;
+  // used for frozen-parameter fine-tuning (-freeze, -freezeList):
+  std::shared_ptr<const std::vector<uint8_t>> frozen_;
+  const uint8_t* frozenRows_;
+  const uint8_t* frozenOutput_;
+  bool freezing_;
 
   static bool comparePairs(const std::pair<real, int32_t>&,
                            const std::pair<real, int32_t>&);
 
   int32_t getNegative(int32_t target);
+  template <loss_name>
+  real computeLoss(int32_t, real);
+  void markInput(int32_t i) const {
+    if (dirtyInput_) dirtyInput_->mark(i);
+  }
+  void markOutput(int32_t i) const {
+    if (dirtyOutput_) dirtyOutput_->mark(i);
+  }
+  bool inputFrozen(int32_t i) const {
+    return args_->freezeInput || (frozenRows_ && frozenRows_[i]);
+  }
+  bool outputFrozen(int32_t i) const {
+    return args_->freezeOutput || (frozenOutput_ && frozenOutput_[i]);
+  }
+  bool attnFrozen(int32_t i) const {
+    return args_->freezeAttn || (frozenRows_ && frozenRows_[i]);
+  }
+  bool trainable(const std::vector<std::pair<int32_t, int32_t>>&,
+                 int32_t) const;
   void initSigmoid();
   void initLog();
 
@@ -75,16 +126,22 @@ class Model {
 
  public:
   Model(std::shared_ptr<Matrix>, std::shared_ptr<Matrix>,
-        std::shared_ptr<Matrix>, std::shared_ptr<Vector>, std::shared_ptr<Args>,
-        int32_t);
+        std::shared_ptr<Matrix>, std::shared_ptr<Matrix>,
+        std::shared_ptr<Vector>, std::shared_ptr<Args>, int32_t);
   ~Model();
 
   real binaryLogistic(int32_t, bool, real);
   real negativeSampling(int32_t, real);
+  real negativeSamplingShared(int32_t, real);
+  void drawNegatives();
+  void seekNegatives();
   real nsContext(int32_t, real, int32_t, int32_t, int32_t, int32_t);
   real blContext(int32_t, bool, real, int32_t, int32_t, int32_t, int32_t);
   real hierarchicalSoftmax(int32_t, real);
   real softmax(int32_t, real);
+  real sampledSoftmax(int32_t, real);
+  real attnScore(int32_t, int32_t) const;
+  void addAttnScore(int32_t, int32_t, real) const;
 
   void predict(const std::vector<int32_t>&, int32_t,
                std::vector<std::pair<real, int32_t>>&, Vector&, Vector&) const;
@@ -99,26 +156,41 @@ class Model {
   void computeAttnHidden(const std::vector<std::pair<int32_t, int32_t>>&,
                          Vector&, std::vector<real>&) const;
   void computeAttnGradient(const std::vector<std::pair<int32_t, int32_t>>&,
-                           Vector&, std::vector<real>&) const;
+                           Vector&, std::vector<real>&);
   void updateAttn(std::vector<std::pair<int32_t, int32_t>>&, int32_t, real);
   void computeAttnHidden2(const std::vector<std::pair<int32_t, int32_t>>&,
                           int32_t, Vector&, std::vector<real>&) const;
   void computeAttnGradient2(const std::vector<std::pair<int32_t, int32_t>>&,
-                            int32_t, Vector&, std::vector<real>&) const;
+                            int32_t, Vector&, std::vector<real>&);
+  void addInputRow(int32_t, real, const Vector&);
+  void countDeferred(int32_t);
+  void flushInputGrad();
   void updateAttn2(std::vector<std::pair<int32_t, int32_t>>&, int32_t, real);
+  template <model_name, loss_name>
+  void updateAttnT(std::vector<std::pair<int32_t, int32_t>>&, int32_t, real);
+  bool evalAttn(std::vector<std::pair<int32_t, int32_t>>&, int32_t, real&);
+  void updateAttnBatch(std::vector<std::pair<int32_t, int32_t>>&, int32_t,
+                       real);
+  void flushAttnBatch(real);
   void computeOutputSoftmax(Vector&, Vector&) const;
   void computeOutputSoftmax();
 
   void setTargetCounts(const std::vector<int64_t>&);
   void initTableNegatives(const std::vector<int64_t>&);
-  void buildTree(const std::vector<int64_t>&);
+  // entries of the negative table of each thread (-dryrun)
+  static int64_t negativeTableSize(const std::vector<int64_t>&);
+  void setTree(std::shared_ptr<const HuffmanTree>);
+  void setDirtyRows(std::shared_ptr<DirtyRows>, std::shared_ptr<DirtyRows>,
+                    std::shared_ptr<DirtyRows>);
+  void setFrozen(std::shared_ptr<const std::vector<uint8_t>>);
   void addGLoss(const std::vector<int32_t>&);
   void addBLoss(real, real, real);
   real getLoss() const;
   real sigmoid(real) const;
   real log(real) const;
+  void softmaxInPlace(real*, int32_t) const;
 
-  std::minstd_rand rng;
+  Rng rng;
 };
 }
 
@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "neighbors.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "vector.h"
+
+namespace fasttext {
+
+Neighbors::Neighbors(std::shared_ptr<Dictionary> dict,
+                     const std::string& filename) {
+  std::ifstream ifs(filename);
+  if (!ifs.is_open()) {
+    std::cerr << "Neighbors file cannot be opened!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  nwords_ = dict->nwords();
+  set_.assign(nwords_, -1);
+  std::vector<std::vector<int32_t>> sets;
+  std::string line, word;
+  while (std::getline(ifs, line)) {
+    std::istringstream in(line);
+    std::vector<int32_t> words;
+    while (in >> word) {
+      int32_t id = dict->getId(word);
+      // a concept below -minCount, or in two sets, is left out
+      if (id >= 0 && set_[id] < 0) {
+        set_[id] = sets.size();
+        words.push_back(id);
+      }
+    }
+    size_.push_back(words.size());
+    sets.push_back(words);
+  }
+  // the concepts that have neighbors, round robin over the sets
+  std::vector<int32_t> candidates;
+  for (size_t i = 0;; i++) {
+    bool more = false;
+    for (const auto& words : sets) {
+      if (words.size() > 1 && i < words.size()) {
+        candidates.push_back(words[i]);
+        more = true;
+      }
+    }
+    if (!more) {
+      break;
+    }
+  }
+  queries_.assign(candidates.begin(),
+                  candidates.begin() +
+                      std::min(candidates.size(), size_t(MAX_QUERIES)));
+  if (queries_.empty()) {
+    std::cerr << "No set of the neighbors file has two concepts of the "
+                 "dictionary." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+/*
+  recall: mean over the queries of the share of the neighbors found. The
+  rows are read while the training threads may write them, so the score
+  is of a snapshot that can mix two updates of a row.
+*/
+real Neighbors::recall(const Matrix& vectors) const {
+  const int64_t dim = vectors.n_;
+  Matrix unit(nwords_, dim);
+  for (int32_t i = 0; i < nwords_; i++) {
+    const real* row = vectors.data_ + i * dim;
+    real norm = 0.0;
+    for (int64_t j = 0; j < dim; j++) {
+      norm += row[j] * row[j];
+    }
+    norm = norm > 0 ? 1.0 / std::sqrt(norm) : 0.0;
+    for (int64_t j = 0; j < dim; j++) {
+      unit.data_[i * dim + j] = row[j] * norm;
+    }
+  }
+  Vector query(dim), scores(nwords_);
+  std::vector<int32_t> ids(nwords_);
+  double total = 0.0;
+  for (int32_t q : queries_) {
+    for (int64_t j = 0; j < dim; j++) {
+      query[j] = unit.data_[q * dim + j];
+    }
+    scores.mul(unit, query);
+    // the query itself is not one of its neighbors
+    scores[q] = -2.0;
+    int32_t k = size_[set_[q]] - 1;
+    for (int32_t i = 0; i < nwords_; i++) {
+      ids[i] = i;
+    }
+    std::nth_element(ids.begin(), ids.begin() + k - 1, ids.end(),
+                     [&](int32_t a, int32_t b) {
+                       return scores[a] > scores[b];
+                     });
+    int32_t found = 0;
+    for (int32_t i = 0; i < k; i++) {
+      found += set_[ids[i]] == set_[q];
+    }
+    total += double(found) / k;
+  }
+  return total / queries_.size();
+}
+}
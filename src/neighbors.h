@@ -0,0 +1,52 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_NEIGHBORS_H
+#define FASTTEXT_NEIGHBORS_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "dictionary.h"
+#include "matrix.h"
+#include "real.h"
+
+namespace fasttext {
+
+/*
+  Neighbors: expected neighbor sets of the concepts (-neighbors), one set
+  per line of concept ids separated by spaces, such as the groups planted
+  by gen-data -cluster. recall scores the vectors of the concepts against
+  them: for each query concept, the share of the other concepts of its set
+  among its nearest neighbors by cosine, as many neighbors as the set has
+  other concepts in the dictionary. At most MAX_QUERIES concepts are
+  queried, spread over the sets, against the whole vocabulary.
+*/
+class Neighbors {
+ private:
+  static const int32_t MAX_QUERIES = 1000;
+
+  // set of each word of the dictionary, -1 if none
+  std::vector<int32_t> set_;
+  // words of the dictionary in each set
+  std::vector<int32_t> size_;
+  std::vector<int32_t> queries_;
+  int32_t nwords_;
+
+ public:
+  Neighbors(std::shared_ptr<Dictionary>, const std::string&);
+
+  int32_t queries() const { return queries_.size(); }
+  real recall(const Matrix&) const;
+};
+}
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "perf.h"
+
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <iomanip>
+
+namespace fasttext {
+
+namespace {
+  const char* const names[PerfCounters::NCOUNTERS] = {
+      "cycles", "instructions", "LLC misses", "dTLB misses"};
+
+  int openCounter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // scaled by the time counted when the counters are multiplexed
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // the calling thread, on any CPU
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+}
+
+PerfCounters::Counts::Counts() {
+  for (int32_t i = 0; i < NCOUNTERS; i++) {
+    value[i] = 0.0;
+    valid[i] = false;
+  }
+}
+
+bool PerfCounters::Counts::any() const {
+  for (int32_t i = 0; i < NCOUNTERS; i++) {
+    if (valid[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PerfCounters::Counts::add(const Counts& other) {
+  for (int32_t i = 0; i < NCOUNTERS; i++) {
+    value[i] += other.value[i];
+    valid[i] = valid[i] || other.valid[i];
+  }
+}
+
+void PerfCounters::Counts::print(std::ostream& out, const std::string& name,
+                                 int64_t tokens) const {
+  out << name << ":";
+  for (int32_t i = 0; i < NCOUNTERS; i++) {
+    if (valid[i]) {
+      out << "  " << std::scientific << std::setprecision(3) << value[i]
+          << " " << names[i];
+    }
+  }
+  out << std::fixed << std::setprecision(2);
+  if (valid[cycles] && valid[instructions] && value[cycles] > 0) {
+    out << "  IPC " << value[instructions] / value[cycles];
+  }
+  if (tokens > 0) {
+    if (valid[cycles]) {
+      out << "  cycles/token " << value[cycles] / tokens;
+    }
+    if (valid[llcMisses]) {
+      out << "  LLC misses/token " << value[llcMisses] / tokens;
+    }
+    if (valid[tlbMisses]) {
+      out << "  dTLB misses/token " << value[tlbMisses] / tokens;
+    }
+  }
+  out << std::endl;
+}
+
+PerfCounters::PerfCounters() {
+  fd_[cycles] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  if (fd_[cycles] < 0) {
+    error_ = strerror(errno);
+  }
+  fd_[instructions] =
+      openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  fd_[llcMisses] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  fd_[tlbMisses] = openCounter(
+      PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+}
+
+PerfCounters::~PerfCounters() {
+  for (int32_t i = 0; i < NCOUNTERS; i++) {
+    if (fd_[i] >= 0) {
+      close(fd_[i]);
+    }
+  }
+}
+
+bool PerfCounters::available() const {
+  for (int32_t i = 0; i < NCOUNTERS; i++) {
+    if (fd_[i] >= 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PerfCounters::start() {
+  for (int32_t i = 0; i < NCOUNTERS; i++) {
+    if (fd_[i] >= 0) {
+      ioctl(fd_[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd_[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+void PerfCounters::stop() {
+  for (int32_t i = 0; i < NCOUNTERS; i++) {
+    if (fd_[i] >= 0) {
+      ioctl(fd_[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+}
+
+PerfCounters::Counts PerfCounters::read() const {
+  Counts counts;
+  for (int32_t i = 0; i < NCOUNTERS; i++) {
+    // value, time enabled, time running
+    uint64_t data[3];
+    if (fd_[i] < 0 || ::read(fd_[i], data, sizeof(data)) != sizeof(data) ||
+        data[2] == 0) {
+      continue;
+    }
+    counts.value[i] = double(data[0]) * data[1] / data[2];
+    counts.valid[i] = true;
+  }
+  return counts;
+}
+}
@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_PERF_H
+#define FASTTEXT_PERF_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace fasttext {
+
+/*
+  PerfCounters: hardware counters of the calling thread (perf_event_open),
+  counted in user space between start and stop: cycles, instructions, last
+  level cache misses and data TLB misses. A counter that the kernel or the
+  CPU does not provide is left out, and available is false when none is
+  (e.g. in most virtual machines, or with perf_event_paranoid > 2).
+*/
+class PerfCounters {
+ public:
+  enum counter : int32_t {
+    cycles = 0,
+    instructions,
+    llcMisses,
+    tlbMisses,
+    NCOUNTERS
+  };
+
+  struct Counts {
+    double value[NCOUNTERS];
+    bool valid[NCOUNTERS];
+
+    Counts();
+    bool any() const;
+    void add(const Counts&);
+    // one line: the counts, and per token if tokens > 0
+    void print(std::ostream&, const std::string&, int64_t tokens) const;
+  };
+
+ private:
+  int fd_[NCOUNTERS];
+  std::string error_;
+
+ public:
+  PerfCounters();
+  ~PerfCounters();
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  bool available() const;
+  // why no counter could be opened
+  const std::string& error() const { return error_; }
+  void start();
+  void stop();
+  Counts read() const;
+};
+}
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "profile.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace fasttext {
+
+namespace profile {
+
+  namespace {
+    // events kept per thread, about 20MB of trace each
+    const size_t MAX_EVENTS = 1 << 18;
+    const int32_t MAX_DEPTH = 16;
+
+    const char* const names[NPHASES] = {"parse",    "context", "negatives",
+                                        "hidden",   "loss",    "gradient",
+                                        "flush",    "batch"};
+
+    struct Event {
+      int32_t phase;
+      int64_t begin;
+      int64_t end;
+    };
+
+    struct Recorder {
+      int32_t id;
+      bool trace;
+      int64_t begin;
+      int64_t end;
+      int64_t ns[NPHASES];
+      int64_t calls[NPHASES];
+      // time of the scopes nested in each open scope
+      int32_t depth;
+      int64_t nested[MAX_DEPTH + 1];
+      std::vector<Event> events;
+      int64_t dropped;
+    };
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Recorder>> recorders;
+    bool tracing = false;
+    int64_t origin = 0;
+    thread_local Recorder* current = nullptr;
+  }
+
+  void reset(bool trace) {
+    std::lock_guard<std::mutex> lock(mutex);
+    recorders.clear();
+    tracing = trace;
+    origin = now();
+  }
+
+  void beginThread(int32_t id) {
+    std::unique_ptr<Recorder> r(new Recorder());
+    r->id = id;
+    r->begin = now();
+    r->end = r->begin;
+    for (int32_t p = 0; p < NPHASES; p++) {
+      r->ns[p] = 0;
+      r->calls[p] = 0;
+    }
+    r->depth = 0;
+    r->nested[0] = 0;
+    r->dropped = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    r->trace = tracing;
+    if (r->trace) {
+      r->events.reserve(MAX_EVENTS);
+    }
+    current = r.get();
+    recorders.push_back(std::move(r));
+  }
+
+  void endThread() {
+    if (current) {
+      current->end = now();
+      current = nullptr;
+    }
+  }
+
+  int64_t enter() {
+    Recorder* r = current;
+    if (r && ++r->depth <= MAX_DEPTH) {
+      r->nested[r->depth] = 0;
+    }
+    return now();
+  }
+
+  void leave(phase p, int64_t begin) {
+    int64_t end = now();
+    Recorder* r = current;
+    if (!r || r->depth == 0) {
+      return;
+    }
+    if (r->depth > MAX_DEPTH) {
+      r->depth--;
+      return;
+    }
+    r->ns[p] += end - begin - r->nested[r->depth];
+    r->nested[--r->depth] += end - begin;
+    r->calls[p]++;
+    if (r->trace) {
+      if (r->events.size() < MAX_EVENTS) {
+        r->events.push_back(Event{p, begin, end});
+      } else {
+        r->dropped++;
+      }
+    }
+  }
+
+  void printSummary(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    int64_t ns[NPHASES] = {0}, calls[NPHASES] = {0};
+    int64_t total = 0, other = 0;
+    for (auto& r : recorders) {
+      total += r->end - r->begin;
+      other += r->end - r->begin;
+      for (int32_t p = 0; p < NPHASES; p++) {
+        ns[p] += r->ns[p];
+        calls[p] += r->calls[p];
+        other -= r->ns[p];
+      }
+    }
+    if (total == 0) {
+      return;
+    }
+    out << std::fixed << std::left << std::setw(12) << "phase" << std::right
+        << std::setw(12) << "seconds" << std::setw(9) << "share"
+        << std::setw(14) << "calls" << std::setw(10) << "ns/call"
+        << std::endl;
+    for (int32_t p = 0; p < NPHASES; p++) {
+      if (calls[p] == 0) {
+        continue;
+      }
+      out << std::left << std::setw(12) << names[p] << std::right
+          << std::setw(12) << std::setprecision(3) << ns[p] / 1e9
+          << std::setw(8) << std::setprecision(1) << 100.0 * ns[p] / total
+          << "%" << std::setw(14) << calls[p] << std::setw(10)
+          << ns[p] / calls[p] << std::endl;
+    }
+    out << std::left << std::setw(12) << "other" << std::right
+        << std::setw(12) << std::setprecision(3) << other / 1e9
+        << std::setw(8) << std::setprecision(1) << 100.0 * other / total
+        << "%" << std::endl;
+    out << std::left << std::setw(12) << "threads" << std::right
+        << std::setw(12) << std::setprecision(3) << total / 1e9 << std::endl;
+  }
+
+  void saveTrace(const std::string& filename) {
+    std::ofstream ofs(filename);
+    if (!ofs.is_open()) {
+      std::cerr << "Trace file cannot be opened for saving!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    int64_t dropped = 0;
+    ofs << std::fixed << std::setprecision(3) << "{\"traceEvents\": [";
+    bool first = true;
+    for (auto& r : recorders) {
+      ofs << (first ? "\n" : ",\n")
+          << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+          << "\"tid\": " << r->id << ", \"args\": {\"name\": \"thread "
+          << r->id << "\"}}";
+      first = false;
+      for (auto& e : r->events) {
+        // Chrome traces are in microseconds
+        ofs << ",\n{\"name\": \"" << names[e.phase]
+            << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << r->id
+            << ", \"ts\": " << (e.begin - origin) / 1e3
+            << ", \"dur\": " << (e.end - e.begin) / 1e3 << "}";
+      }
+      dropped += r->dropped;
+    }
+    ofs << "\n], \"displayTimeUnit\": \"ns\"}" << std::endl;
+    if (dropped > 0) {
+      std::cout << "Trace: " << dropped << " events past the first "
+                << MAX_EVENTS << " of each thread were not kept" << std::endl;
+    }
+  }
+}
+
+}
@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_PROFILE_H
+#define FASTTEXT_PROFILE_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace fasttext {
+
+/*
+  profile: scoped timers on the phases of the training threads, built with
+  `make profile` (MCE_PROFILE). Each thread adds the time of its scopes to
+  its own totals and, with a trace, keeps them as events of a Chrome trace
+  (chrome://tracing, ui.perfetto.dev). Scopes may nest: the time of a phase
+  excludes the scopes opened inside it, so the phases split the time of the
+  thread.
+*/
+namespace profile {
+
+  enum phase : int32_t {
+    parse = 0,
+    context,
+    negatives,
+    hidden,
+    loss,
+    gradient,
+    flush,
+    batch,
+    NPHASES
+  };
+
+  inline int64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // drops the recorded threads; events are kept if trace
+  void reset(bool trace);
+  // the calling thread records its scopes as thread id until endThread
+  void beginThread(int32_t id);
+  void endThread();
+  int64_t enter();
+  void leave(phase, int64_t begin);
+
+  // time per phase over all the threads
+  void printSummary(std::ostream&);
+  void saveTrace(const std::string&);
+
+  class Scope {
+   private:
+    phase phase_;
+    int64_t begin_;
+
+   public:
+    explicit Scope(phase p) : phase_(p), begin_(enter()) {}
+    ~Scope() { leave(phase_, begin_); }
+  };
+
+  class ThreadScope {
+   public:
+    explicit ThreadScope(int32_t id) { beginThread(id); }
+    ~ThreadScope() { endThread(); }
+  };
+}
+
+}
+
+#ifdef MCE_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(p) \
+  fasttext::profile::Scope PROFILE_CONCAT(profileScope, __LINE__)( \
+      fasttext::profile::p)
+#define PROFILE_THREAD(id) \
+  fasttext::profile::ThreadScope PROFILE_CONCAT(profileThread, __LINE__)(id)
+#else
+#define PROFILE_SCOPE(p)
+#define PROFILE_THREAD(id)
+#endif
+
+#endif
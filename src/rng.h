@@ -0,0 +1,90 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_RNG_H
+#define FASTTEXT_RNG_H
+
+#include <cstdint>
+#include <limits>
+
+#include "real.h"
+
+namespace fasttext {
+
+/*
+  Rng: xoshiro128+ generator used on the training hot path. The state is
+  derived from a 64-bit key with splitmix64, so any (key, stream) pair gives
+  an independent sequence: this is what makes the draws for a patient depend
+  only on the patient and the epoch when -patientSeed is set. It satisfies
+  UniformRandomBitGenerator, so it can be passed to std::shuffle. The
+  members are defined here so that they inline into the training loops.
+*/
+class Rng {
+ private:
+  uint32_t s_[4];
+  uint64_t stream_;
+
+  static uint64_t splitmix64(uint64_t& x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  static uint32_t rotl(uint32_t x, int k) { return (x << k) | (x >> (32 - k)); }
+
+ public:
+  typedef uint32_t result_type;
+
+  explicit Rng(uint64_t seed) : stream_(0) { this->seed(seed); }
+
+  void seed(uint64_t key) {
+    uint64_t x = key ^ (stream_ * 0xd1b54a32d192ed03ULL);
+    uint64_t a = splitmix64(x);
+    uint64_t b = splitmix64(x);
+    s_[0] = uint32_t(a);
+    s_[1] = uint32_t(a >> 32);
+    s_[2] = uint32_t(b);
+    s_[3] = uint32_t(b >> 32);
+    if ((s_[0] | s_[1] | s_[2] | s_[3]) == 0) {
+      s_[0] = 1;
+    }
+  }
+
+  // the stream is mixed into the key by the following calls to seed()
+  void setStream(uint64_t stream) { stream_ = stream; }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  result_type operator()() {
+    uint32_t result = s_[0] + s_[3];
+    uint32_t t = s_[1] << 9;
+    s_[2] ^= s_[0];
+    s_[3] ^= s_[1];
+    s_[1] ^= s_[2];
+    s_[0] ^= s_[3];
+    s_[2] ^= t;
+    s_[3] = rotl(s_[3], 11);
+    return result;
+  }
+
+  // uniform in [0, 1), from the 24 high bits
+  real uniform() { return real((*this)() >> 8) * (1.0f / 16777216.0f); }
+
+  // uniform in [0, n), by multiply-shift (bias below n / 2^32)
+  int32_t bounded(int32_t n) {
+    return int32_t((uint64_t((*this)()) * uint32_t(n)) >> 32);
+  }
+};
+}
+
+#endif
@@ -0,0 +1,67 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "shm.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+
+namespace fasttext {
+
+SharedSegment::SharedSegment(const std::string& name, size_t size)
+    : name_(name), data_(nullptr), size_(size), used_(0) {
+  int fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    std::cerr << "Shared memory " << name_
+              << " cannot be created: " << strerror(errno) << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (ftruncate(fd, size_) != 0) {
+    std::cerr << "Shared memory " << name_ << " cannot be sized to " << size_
+              << " bytes: " << strerror(errno) << std::endl;
+    close(fd);
+    shm_unlink(name_.c_str());
+    exit(EXIT_FAILURE);
+  }
+  void* p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    std::cerr << "Shared memory " << name_
+              << " cannot be mapped: " << strerror(errno) << std::endl;
+    shm_unlink(name_.c_str());
+    exit(EXIT_FAILURE);
+  }
+  // the workers inherit the mapping, so the name is not needed anymore and
+  // the memory is released with the last mapping, however the processes end
+  shm_unlink(name_.c_str());
+  data_ = static_cast<char*>(p);
+}
+
+SharedSegment::~SharedSegment() { munmap(data_, size_); }
+
+size_t SharedSegment::aligned(size_t bytes) {
+  return (bytes + ALIGN - 1) / ALIGN * ALIGN;
+}
+
+char* SharedSegment::take(size_t bytes) {
+  char* p = data_ + used_;
+  used_ += aligned(bytes);
+  if (used_ > size_) {
+    std::cerr << "Shared memory " << name_ << " is too small." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+}
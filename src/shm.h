@@ -0,0 +1,45 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_SHM_H
+#define FASTTEXT_SHM_H
+
+#include <cstddef>
+#include <string>
+
+namespace fasttext {
+
+/*
+  SharedSegment: a POSIX shared memory segment (shm_open and mmap), created
+  by the coordinator of -workers and inherited by the worker processes it
+  forks. The segment is unlinked as soon as it is mapped, so that nothing is
+  left in /dev/shm when a process is killed; take hands out consecutive
+  blocks aligned to cache lines.
+*/
+class SharedSegment {
+ private:
+  std::string name_;
+  char* data_;
+  size_t size_;
+  size_t used_;
+
+  static const size_t ALIGN = 64;
+
+ public:
+  SharedSegment(const std::string&, size_t);
+  ~SharedSegment();
+
+  static size_t aligned(size_t);
+  char* take(size_t);
+  const std::string& name() const { return name_; }
+  size_t size() const { return size_; }
+};
+}
+
+#endif
@@ -0,0 +1,84 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "tree.h"
+
+#include <algorithm>
+
+namespace fasttext {
+
+HuffmanTree::HuffmanTree(const std::vector<int64_t>& counts) {
+  osz_ = counts.size();
+  tree_.resize(2 * osz_ - 1);
+  for (int32_t i = 0; i < 2 * osz_ - 1; i++) {
+    tree_[i].parent = -1;
+    tree_[i].left = -1;
+    tree_[i].right = -1;
+    tree_[i].count = 1e15;
+    tree_[i].binary = false;
+  }
+  for (int32_t i = 0; i < osz_; i++) {
+    tree_[i].count = counts[i];
+  }
+  // leaves by descending count; this is the identity unless the dictionary
+  // was reordered (-reorder)
+  std::vector<int32_t> leaves(osz_);
+  for (int32_t i = 0; i < osz_; i++) {
+    leaves[i] = i;
+  }
+  std::stable_sort(leaves.begin(), leaves.end(),
+                   [&counts](int32_t a, int32_t b) {
+                     return counts[a] > counts[b];
+                   });
+  int32_t leaf = osz_ - 1;
+  int32_t node = osz_;
+  for (int32_t i = osz_; i < 2 * osz_ - 1; i++) {
+    int32_t mini[2];
+    for (int32_t j = 0; j < 2; j++) {
+      if (leaf >= 0 && tree_[leaves[leaf]].count < tree_[node].count) {
+        mini[j] = leaves[leaf--];
+      } else {
+        mini[j] = node++;
+      }
+    }
+    tree_[i].left = mini[0];
+    tree_[i].right = mini[1];
+    tree_[i].count = tree_[mini[0]].count + tree_[mini[1]].count;
+    tree_[mini[0]].parent = i;
+    tree_[mini[1]].parent = i;
+    tree_[mini[1]].binary = true;
+  }
+  // first pass sizes the paths, the second fills them in place
+  offsets_.resize(osz_ + 1);
+  offsets_[0] = 0;
+  for (int32_t i = 0; i < osz_; i++) {
+    int32_t depth = 0;
+    for (int32_t j = i; tree_[j].parent != -1; j = tree_[j].parent) {
+      depth++;
+    }
+    offsets_[i + 1] = offsets_[i] + depth;
+  }
+  paths_.resize(offsets_[osz_]);
+  codes_.resize(offsets_[osz_]);
+  for (int32_t i = 0; i < osz_; i++) {
+    int64_t k = offsets_[i];
+    for (int32_t j = i; tree_[j].parent != -1; j = tree_[j].parent) {
+      paths_[k] = tree_[j].parent - osz_;
+      codes_[k] = tree_[j].binary;
+      k++;
+    }
+  }
+}
+
+int64_t HuffmanTree::bytes() const {
+  return sizeof(Node) * tree_.capacity() +
+         sizeof(int64_t) * offsets_.capacity() +
+         sizeof(int32_t) * paths_.capacity() + codes_.capacity();
+}
+}
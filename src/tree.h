@@ -0,0 +1,55 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_TREE_H
+#define FASTTEXT_TREE_H
+
+#include <cstdint>
+#include <vector>
+
+namespace fasttext {
+
+struct Node {
+  int32_t parent;
+  int32_t left;
+  int32_t right;
+  int64_t count;
+  bool binary;
+};
+
+/*
+  HuffmanTree: the tree used by hierarchical softmax. The path from every
+  leaf to the root is stored contiguously (CSR layout): the inner nodes and
+  binary codes of leaf i are at [offsets_[i], offsets_[i + 1]) in paths_ and
+  codes_. The tree is immutable once built, so a single instance is shared
+  read-only by the models of all threads.
+*/
+class HuffmanTree {
+ private:
+  int32_t osz_;
+  std::vector<Node> tree_;
+  std::vector<int64_t> offsets_;
+  std::vector<int32_t> paths_;
+  std::vector<uint8_t> codes_;
+
+ public:
+  explicit HuffmanTree(const std::vector<int64_t>&);
+
+  // memory held by the tree, in bytes (-dryrun)
+  int64_t bytes() const;
+  const Node& node(int32_t i) const { return tree_[i]; }
+  const int32_t* path(int32_t i) const { return paths_.data() + offsets_[i]; }
+  const uint8_t* code(int32_t i) const { return codes_.data() + offsets_[i]; }
+  int32_t pathLength(int32_t i) const {
+    return int32_t(offsets_[i + 1] - offsets_[i]);
+  }
+};
+}
+
+#endif
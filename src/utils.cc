@@ -29,11 +29,13 @@ namespace utils {
     ifs.clear();
     std::streambuf& sb = *ifs.rdbuf();
     int32_t off = 0;
-    for (off = 0; ifs.seekg(std::streampos(pos - off)); off++) {
+    for (off = 0; pos - off >= 0 && ifs.seekg(std::streampos(pos - off));
+         off++) {
       char c = sb.sbumpc();
       if (c == '\n')
         break;
     }
+    ifs.clear();
     ifs.seekg(std::streampos(pos - off + 1));
   }
 }
@@ -20,9 +20,21 @@ namespace fasttext {
 Vector::Vector(int64_t m) {
   m_ = m;
   data_ = new real[m];
+  owner_ = true;
 }
 
-Vector::~Vector() { delete[] data_; }
+/*
+  Vector: a view of m values of data, which are not freed with the vector.
+*/
+Vector::Vector(int64_t m, real* data) {
+  m_ = m;
+  data_ = data;
+  owner_ = false;
+}
+
+Vector::~Vector() {
+  if (owner_) delete[] data_;
+}
 
 int64_t Vector::size() const { return m_; }
 
@@ -121,8 +133,9 @@ void Vector::save(std::ostream& out) {
 
 void Vector::load(std::istream& in) {
   in.read((char*)&m_, sizeof(int64_t));
-  delete[] data_;
+  if (owner_) delete[] data_;
   data_ = new real[m_];
+  owner_ = true;
   in.read((char*)data_, m_ * sizeof(real));
 }
 }
@@ -23,8 +23,11 @@ class Vector {
  public:
   int64_t m_;
   real* data_;
+  // false for a view of memory owned elsewhere (-workers)
+  bool owner_;
 
   explicit Vector(int64_t);
+  Vector(int64_t, real*);
   ~Vector();
 
   real& operator[](int64_t);